@@ -0,0 +1,202 @@
+#include "Aggregation.h"
+#include <stdlib.h>
+#include <string.h>
+
+namespace log_test
+{
+    namespace
+    {
+        bool IsDigit(char ch)
+        {
+            return ch >= '0' && ch <= '9';
+        }
+
+        bool IsHexDigit(char ch)
+        {
+            return IsDigit(ch) || (ch >= 'a' && ch <= 'f') || (ch >= 'A' && ch <= 'F');
+        }
+
+        bool IsWordChar(char ch)
+        {
+            return IsDigit(ch) || (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z');
+        }
+
+        // A 0x number or a hexadecimal word with at least one digit
+        bool IsHexWord(const char* word, size_t size)
+        {
+            size_t begin{};
+            if (size > 2 && word[0] == '0' && (word[1] == 'x' || word[1] == 'X'))
+            {
+                begin = 2;
+            }
+            bool has_digit = begin != 0;
+            for (size_t i = begin; i < size; ++i)
+            {
+                if (!IsHexDigit(word[i])) return false;
+                has_digit = has_digit || IsDigit(word[i]);
+            }
+            return has_digit;
+        }
+
+        unsigned HashKey(const char* key, size_t size)
+        {
+            unsigned hash = 2166136261u;
+            for (size_t i{}; i < size; ++i)
+            {
+                hash = (hash ^ static_cast<unsigned char>(key[i])) * 16777619u;
+            }
+            return hash;
+        }
+
+        template<typename T>
+        int CompareKeys(const T& left, const T& right)
+        {
+            const int result = memcmp(left.key, right.key, min(left.key_size, right.key_size));
+            if (result) return result;
+            return left.key_size < right.key_size ? -1 : left.key_size > right.key_size;
+        }
+    }
+
+    size_t MaskTemplate(const char* line, size_t line_size, char* out, size_t out_size)
+    {
+        size_t out_used{};
+        for (size_t i{}; i < line_size && out_used < out_size;)
+        {
+            if (!IsWordChar(line[i]))
+            {
+                out[out_used++] = line[i++];
+                continue;
+            }
+
+            size_t word_end = i;
+            while (word_end < line_size && IsWordChar(line[word_end]))
+            {
+                ++word_end;
+            }
+            if (IsHexWord(line + i, word_end - i))
+            {
+                out[out_used++] = '#';
+                i = word_end;
+                continue;
+            }
+            while (i < word_end && out_used < out_size)
+            {
+                if (!IsDigit(line[i]))
+                {
+                    out[out_used++] = line[i++];
+                    continue;
+                }
+                out[out_used++] = '#';
+                while (i < word_end && IsDigit(line[i]))
+                {
+                    ++i;
+                }
+            }
+        }
+        return out_used;
+    }
+
+    bool CCountTable::Add(const char* key, size_t key_size, unsigned long long count)
+    {
+        if (2 * (entries.Size() + 1) > index.Size() && !Rehash(index.IsEmpty() ? initial_index_size : 2 * index.Size()))
+        {
+            print_last_error("Bad alloc");
+            return false;
+        }
+
+        const unsigned hash = HashKey(key, key_size);
+        const size_t index_mask = index.Size() - 1;
+        size_t i = hash & index_mask;
+        for (; index[i]; i = (i + 1) & index_mask)
+        {
+            auto& entry = entries[index[i] - 1];
+            if (entry.hash == hash && entry.key_size == key_size && !memcmp(keys.Data() + entry.key_offset, key, key_size))
+            {
+                entry.count += count;
+                return true;
+            }
+        }
+
+        const Entry entry{ hash, keys.Size(), key_size, count };
+        if (!keys.Resize(keys.Size() + key_size + 1) || !entries.PushBack(entry))
+        {
+            print_last_error("Bad alloc");
+            return false;
+        }
+        CopyMemory(keys.Data() + entry.key_offset, key, key_size);
+        index[i] = entries.Size();
+        return true;
+    }
+
+    bool CCountTable::Merge(const CCountTable& other)
+    {
+        for (size_t i{}; i < other.entries.Size(); ++i)
+        {
+            const auto& entry = other.entries[i];
+            if (!Add(other.keys.Data() + entry.key_offset, entry.key_size, entry.count)) return false;
+        }
+        return true;
+    }
+
+    void CCountTable::EnumerateByKey(CountFun f) const
+    {
+        SimpleArray<SortedEntry> sorted;
+        const auto compare = [](const void* left, const void* right)
+        {
+            return CompareKeys(*static_cast<const SortedEntry*>(left), *static_cast<const SortedEntry*>(right));
+        };
+        if (!Sort(sorted, compare)) return;
+        for (size_t i{}; i < sorted.Size(); ++i)
+        {
+            f(sorted[i].key, sorted[i].key_size, sorted[i].count);
+        }
+    }
+
+    void CCountTable::EnumerateTop(size_t top_count, CountFun f) const
+    {
+        SimpleArray<SortedEntry> sorted;
+        const auto compare = [](const void* left, const void* right)
+        {
+            const auto& left_entry = *static_cast<const SortedEntry*>(left);
+            const auto& right_entry = *static_cast<const SortedEntry*>(right);
+            if (left_entry.count != right_entry.count) return left_entry.count > right_entry.count ? -1 : 1;
+            return CompareKeys(left_entry, right_entry);
+        };
+        if (!Sort(sorted, compare)) return;
+        for (size_t i{}; i < sorted.Size() && i < top_count; ++i)
+        {
+            f(sorted[i].key, sorted[i].key_size, sorted[i].count);
+        }
+    }
+
+    bool CCountTable::Rehash(size_t index_size)
+    {
+        index.Reset();
+        if (!index.Resize(index_size)) return false;
+        for (size_t entry_index{}; entry_index < entries.Size(); ++entry_index)
+        {
+            size_t i = entries[entry_index].hash & (index_size - 1);
+            while (index[i])
+            {
+                i = (i + 1) & (index_size - 1);
+            }
+            index[i] = entry_index + 1;
+        }
+        return true;
+    }
+
+    bool CCountTable::Sort(SimpleArray<SortedEntry>& sorted, int (*compare)(const void*, const void*)) const
+    {
+        if (!sorted.Resize(entries.Size()))
+        {
+            print_last_error("Bad alloc");
+            return false;
+        }
+        for (size_t i{}; i < entries.Size(); ++i)
+        {
+            sorted[i] = { keys.Data() + entries[i].key_offset, entries[i].key_size, entries[i].count };
+        }
+        qsort(sorted.Data(), sorted.Size(), sizeof(SortedEntry), compare);
+        return true;
+    }
+}
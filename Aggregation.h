@@ -0,0 +1,71 @@
+#pragma once
+#include <windows.h>
+#include "Utilities.h"
+
+namespace log_test
+{
+    // Receives a key of an aggregation and the number of matched lines with the key
+    using CountFun = void(*)(const char* key, size_t key_size, unsigned long long count);
+
+    // Writes the template of the line to out: a run of digits, a hexadecimal word with a digit or a 0x number becomes '#',
+    // returns the size of the template which is cut to out_size
+    size_t MaskTemplate(const char* line, size_t line_size, char* out, size_t out_size);
+
+    /*********************************************************************************************
+    /*
+    /* Counters by key in a hash table with open addressing, the keys are kept one after another
+    /* in one buffer. Each scan thread fills its own table, the tables are merged at the end.
+    /*
+    /*********************************************************************************************/
+    class CCountTable final
+    {
+        CCountTable(CCountTable&) = delete;
+        CCountTable(CCountTable&&) = delete;
+
+        CCountTable& operator=(CCountTable&) = delete;
+        CCountTable& operator=(CCountTable&&) = delete;
+
+    public:
+        CCountTable() = default;
+
+        // Adds count to the counter of the key, false if there is no memory
+        bool Add(const char* key, size_t key_size, unsigned long long count = 1);
+
+        // Adds the counters of the other table
+        bool Merge(const CCountTable& other);
+
+        // Calls the functor for the keys sorted in ascending order
+        void EnumerateByKey(CountFun f) const;
+
+        // Calls the functor for the top_count keys with the largest counters, the largest first
+        void EnumerateTop(size_t top_count, CountFun f) const;
+
+    private:
+        struct Entry
+        {
+            unsigned hash;
+            size_t key_offset;
+            size_t key_size;
+            unsigned long long count;
+        };
+
+        struct SortedEntry
+        {
+            const char* key;
+            size_t key_size;
+            unsigned long long count;
+        };
+
+        bool Rehash(size_t index_size);
+        bool Sort(SimpleArray<SortedEntry>& sorted, int (*compare)(const void*, const void*)) const;
+
+    private:
+        static constexpr size_t initial_index_size = 1024;
+
+        SimpleArray<Entry> entries;
+        // Index of the entry plus one, 0 is an empty slot
+        SimpleArray<size_t> index;
+        // The keys with a terminating zero each
+        SimpleArray<char> keys;
+    };
+}
@@ -0,0 +1,232 @@
+#include "Kernels.h"
+#include "Utilities.h"
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#include <immintrin.h>
+#define LOG_TEST_X86_KERNELS
+#endif
+
+namespace log_test
+{
+    namespace
+    {
+        constexpr char isa_variable[] = "LOGREADER_ISA";
+        constexpr size_t isa_name_size = 16;
+        const char* const isa_names[] = { "generic", "sse2", "avx2", "avx512" };
+
+        struct KernelTable
+        {
+            const char* (*find_byte)(const char* text, size_t size, char ch);
+            const char* (*find_literal)(const char* text, size_t size, const char* literal, size_t literal_size);
+            bool (*equal_masked)(const char* text, const char* pattern, size_t size, char any);
+        };
+
+        const char* FindByteGeneric(const char* text, size_t size, char ch)
+        {
+            return static_cast<const char*>(memchr(text, ch, size));
+        }
+
+        const char* FindLiteralGeneric(const char* text, size_t size, const char* literal, size_t literal_size)
+        {
+            if (!literal_size) return text;
+            while (size >= literal_size)
+            {
+                const auto* first = static_cast<const char*>(memchr(text, literal[0], size - literal_size + 1));
+                if (!first) return nullptr;
+                if (!memcmp(first + 1, literal + 1, literal_size - 1)) return first;
+                size -= first - text + 1;
+                text = first + 1;
+            }
+            return nullptr;
+        }
+
+        bool EqualMaskedGeneric(const char* text, const char* pattern, size_t size, char any)
+        {
+            for (size_t i{}; i < size; ++i)
+            {
+                if (pattern[i] != any && pattern[i] != text[i]) return false;
+            }
+            return true;
+        }
+
+#ifdef LOG_TEST_X86_KERNELS
+        unsigned long LowestBit(unsigned long long mask)
+        {
+            unsigned long index{};
+#ifdef _M_X64
+            _BitScanForward64(&index, mask);
+#else
+            if (!_BitScanForward(&index, static_cast<unsigned long>(mask)))
+            {
+                _BitScanForward(&index, static_cast<unsigned long>(mask >> 32));
+                index += 32;
+            }
+#endif
+            return index;
+        }
+
+        // The vector operations of an instruction set, Equal returns one bit per byte
+        struct Sse2
+        {
+            using Vector = __m128i;
+            static constexpr size_t width = 16;
+            static constexpr unsigned long long all = 0xFFFF;
+            static Vector Load(const char* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+            static Vector Broadcast(char ch) { return _mm_set1_epi8(ch); }
+            static unsigned long long Equal(Vector a, Vector b) { return static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(a, b))); }
+        };
+
+        struct Avx2
+        {
+            using Vector = __m256i;
+            static constexpr size_t width = 32;
+            static constexpr unsigned long long all = 0xFFFFFFFF;
+            static Vector Load(const char* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+            static Vector Broadcast(char ch) { return _mm256_set1_epi8(ch); }
+            static unsigned long long Equal(Vector a, Vector b) { return static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b))); }
+        };
+
+        struct Avx512
+        {
+            using Vector = __m512i;
+            static constexpr size_t width = 64;
+            static constexpr unsigned long long all = ~0ull;
+            static Vector Load(const char* p) { return _mm512_loadu_si512(p); }
+            static Vector Broadcast(char ch) { return _mm512_set1_epi8(ch); }
+            static unsigned long long Equal(Vector a, Vector b) { return _mm512_cmpeq_epi8_mask(a, b); }
+        };
+
+        // The tails shorter than a vector are left to the generic kernels
+        template<typename Isa>
+        const char* FindByteVector(const char* text, size_t size, char ch)
+        {
+            const auto needle = Isa::Broadcast(ch);
+            size_t i{};
+            for (; i + Isa::width <= size; i += Isa::width)
+            {
+                const auto mask = Isa::Equal(Isa::Load(text + i), needle);
+                if (mask) return text + i + LowestBit(mask);
+            }
+            return FindByteGeneric(text + i, size - i, ch);
+        }
+
+        // The candidates are the positions where both the first and the last byte of the literal match
+        template<typename Isa>
+        const char* FindLiteralVector(const char* text, size_t size, const char* literal, size_t literal_size)
+        {
+            if (literal_size < 2) return literal_size ? FindByteVector<Isa>(text, size, literal[0]) : text;
+
+            const auto first = Isa::Broadcast(literal[0]);
+            const auto last = Isa::Broadcast(literal[literal_size - 1]);
+            size_t i{};
+            for (; i + literal_size - 1 + Isa::width <= size; i += Isa::width)
+            {
+                auto mask = Isa::Equal(Isa::Load(text + i), first) & Isa::Equal(Isa::Load(text + i + literal_size - 1), last);
+                while (mask)
+                {
+                    const auto* candidate = text + i + LowestBit(mask);
+                    if (!memcmp(candidate + 1, literal + 1, literal_size - 2)) return candidate;
+                    mask &= mask - 1;
+                }
+            }
+            return FindLiteralGeneric(text + i, size - i, literal, literal_size);
+        }
+
+        template<typename Isa>
+        bool EqualMaskedVector(const char* text, const char* pattern, size_t size, char any)
+        {
+            const auto any_vector = Isa::Broadcast(any);
+            size_t i{};
+            for (; i + Isa::width <= size; i += Isa::width)
+            {
+                const auto pattern_vector = Isa::Load(pattern + i);
+                if ((Isa::Equal(Isa::Load(text + i), pattern_vector) | Isa::Equal(pattern_vector, any_vector)) != Isa::all) return false;
+            }
+            return EqualMaskedGeneric(text + i, pattern + i, size - i, any);
+        }
+#endif
+
+        KernelIsa DetectIsa()
+        {
+#ifdef LOG_TEST_X86_KERNELS
+            int info[4] = {};
+            __cpuid(info, 0);
+            const int max_leaf = info[0];
+
+            __cpuid(info, 1);
+            if (!(info[3] & (1 << 26))) return KernelIsa::Generic;
+            // The OS saves the AVX registers
+            const bool has_osxsave = (info[2] & (1 << 27)) != 0;
+            const bool has_avx = (info[2] & (1 << 28)) != 0;
+            if (max_leaf < 7 || !has_osxsave || !has_avx) return KernelIsa::Sse2;
+            const auto xcr0 = _xgetbv(0);
+            if ((xcr0 & 0x6) != 0x6) return KernelIsa::Sse2;
+
+            __cpuidex(info, 7, 0);
+            const bool has_avx2 = (info[1] & (1 << 5)) != 0;
+            const bool has_avx512bw = (info[1] & (1 << 16)) && (info[1] & (1 << 30));
+            // The opmask and the upper ZMM registers are saved as well
+            if (has_avx2 && has_avx512bw && (xcr0 & 0xE0) == 0xE0) return KernelIsa::Avx512;
+            if (has_avx2) return KernelIsa::Avx2;
+            return KernelIsa::Sse2;
+#else
+            return KernelIsa::Generic;
+#endif
+        }
+
+        KernelIsa SelectIsa()
+        {
+            const auto isa = DetectIsa();
+            char name[isa_name_size] = {};
+            const DWORD name_size = GetEnvironmentVariableA(isa_variable, name, isa_name_size);
+            if (!name_size) return isa;
+
+            for (int i{}; i <= static_cast<int>(isa) && name_size < isa_name_size; ++i)
+            {
+                if (!_stricmp(name, isa_names[i])) return static_cast<KernelIsa>(i);
+            }
+            print_last_error("LOGREADER_ISA is unknown or not supported by the CPU");
+            return isa;
+        }
+
+        const KernelTable kernel_tables[] =
+        {
+            { FindByteGeneric, FindLiteralGeneric, EqualMaskedGeneric },
+#ifdef LOG_TEST_X86_KERNELS
+            { FindByteVector<Sse2>, FindLiteralVector<Sse2>, EqualMaskedVector<Sse2> },
+            { FindByteVector<Avx2>, FindLiteralVector<Avx2>, EqualMaskedVector<Avx2> },
+            { FindByteVector<Avx512>, FindLiteralVector<Avx512>, EqualMaskedVector<Avx512> },
+#endif
+        };
+
+        const KernelIsa selected_isa = SelectIsa();
+        const KernelTable& kernels = kernel_tables[static_cast<int>(selected_isa)];
+    }
+
+    KernelIsa SelectedIsa()
+    {
+        return selected_isa;
+    }
+
+    const char* IsaName(KernelIsa isa)
+    {
+        return isa_names[static_cast<int>(isa)];
+    }
+
+    const char* FindByte(const char* text, size_t size, char ch)
+    {
+        return kernels.find_byte(text, size, ch);
+    }
+
+    const char* FindLiteral(const char* text, size_t size, const char* literal, size_t literal_size)
+    {
+        return kernels.find_literal(text, size, literal, literal_size);
+    }
+
+    bool EqualMasked(const char* text, const char* pattern, size_t size, char any)
+    {
+        return kernels.equal_masked(text, pattern, size, any);
+    }
+}
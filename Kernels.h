@@ -0,0 +1,36 @@
+#pragma once
+#include <windows.h>
+
+namespace log_test
+{
+    /*********************************************************************************************
+    /*
+    /* The byte scanning kernels of the hot loops, each one is built for several instruction sets.
+    /* The best variant the CPU supports is selected once at startup with cpuid,
+    /* the environment variable LOGREADER_ISA = generic | sse2 | avx2 | avx512 forces another one
+    /* which the CPU supports as well. The command line tool reports the variant in use on stderr
+    /* when the variable is set.
+    /*
+    /*********************************************************************************************/
+    enum class KernelIsa
+    {
+        Generic,
+        Sse2,
+        Avx2,
+        Avx512
+    };
+
+    // The variant of the kernels in use
+    KernelIsa SelectedIsa();
+
+    const char* IsaName(KernelIsa isa);
+
+    // Finds the first ch in the text, nullptr if there is none
+    const char* FindByte(const char* text, size_t size, char ch);
+
+    // Finds the first occurrence of the literal in the text, nullptr if there is none
+    const char* FindLiteral(const char* text, size_t size, const char* literal, size_t literal_size);
+
+    // Compares the text with a pattern of the same size, the any character of the pattern matches every byte
+    bool EqualMasked(const char* text, const char* pattern, size_t size, char any);
+}
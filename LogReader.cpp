@@ -1,202 +1,26 @@
 #include "LogReader.h"
 #include "SimpleRegexp.h"
+#include "TextFile.h"
 #include <process.h>
+#include <string.h>
 
 namespace log_test
 {
-    class CTextFile final
+    namespace
     {
-        static constexpr unsigned long long offset_mask = 0xFFFFFFFFul;
-    public:
-
-        CTextFile() = default;
-
-        CTextFile(const char* file_name)
-        {
-            Open(file_name);
-        }
-
-        ~CTextFile()
-        {
-            Reset();
-        }
-
-        // Read the characters and put to buffer the strings up to \\r\\n
-        const char* ReadLine()
-        {
-            if (Eof()) return {};
-            bool bad_alloc_flag = false;
-            current_line.Reset();
-
-            for (size_t i{}; IsOpen(); ++i)
-            {
-                const auto ch = ReadByte();
-                if (ch == '\r')
-                {
-                    if (Eof() || (ReadByte() == '\n'))
-                    {
-                        if (!current_line.PushBack(0))
-                        {
-                            bad_alloc_flag = true;
-                            break;
-                        }
-                        return current_line.Data();
-                    };
-                    break;
-                }
-                if (!current_line.PushBack(ch))
-                {
-                    bad_alloc_flag = true;
-                    break;
-                }
-            }
-
-            print_last_error(bad_alloc_flag ? "Bad alloc" : "Bad file");
-            Reset();
-            return {};
-        }
-
-        bool Eof() const
-        {
-            return current_pos >= file_size;
-        }
-
-        bool IsOpen() const
-        {
-            return is_open;
-        }
-
-        // Open the file and create a memory mapped object
-        void Open(const char* file_name)
-        {
-            Reset();
-
-            hFile = CreateFileA(
-                file_name,
-                GENERIC_READ,
-                FILE_SHARE_READ,
-                0,
-                OPEN_EXISTING,
-                FILE_ATTRIBUTE_NORMAL,
-                0);
-
-            if (hFile == INVALID_HANDLE_VALUE)
-            {
-                print_last_error("CreateFileA");
-                return;
-            }
-
-            LARGE_INTEGER filesize{};
-
-            if (!GetFileSizeEx(hFile, &filesize))
-            {
-                print_last_error("GetFileSizeEx");
-                Reset();
-                return;
-            }
-
-            file_size = static_cast<unsigned long long>(filesize.QuadPart);
-
-            hMapFile = CreateFileMapping(hFile, nullptr, PAGE_READONLY, filesize.HighPart, filesize.LowPart, nullptr);
-            if (!hMapFile)
-            {
-                print_last_error("CreateFileMapping");
-                Reset();
-                return;
-            }
-            is_open = true;
-            NextMapView();
-        }
-
-        // release all resources
-        void Reset()
-        {
-            is_open = false;
-            file_size = 0;
-            current_pos = 0;
-            UnMapView();
-            if (hMapFile)
-            {
-                CloseHandle(hMapFile);
-                hMapFile = NULL;
-            }
-
-            if (hFile != INVALID_HANDLE_VALUE)
-            {
-                CloseHandle(hFile);
-                hFile = INVALID_HANDLE_VALUE;
-            }
-        }
-
-    private:
-        // Reads the next byte from the MapView, if the MapView is over, shifts further by chunk_size
-        char ReadByte()
-        {
-            if (!current_chunk_size)
-            {
-                NextMapView();
-            }
-            --current_chunk_size;
-            ++current_pos;
-            return *pos_map_view++;
-        }
-        
-        // Shifts further by chunk_size
-        void NextMapView()
-        {
-            UnMapView();
-            const auto high = static_cast<DWORD>((offset >> 32) & offset_mask);
-            const auto low = static_cast<DWORD>(offset & offset_mask);
-            current_chunk_size = (offset + chunk_size) > file_size ? static_cast<int>(file_size - offset) : chunk_size;
-            offset += current_chunk_size;
-            map_view = pos_map_view = static_cast<char*>(MapViewOfFile(hMapFile, FILE_MAP_READ, high, low, current_chunk_size));
-            if (!map_view)
-            {
-                print_last_error("MapViewOfFile");
-                Reset();
-            }
-        }
-
-        void UnMapView()
-        {
-            if (map_view)
-            {
-                UnmapViewOfFile(map_view);
-                map_view = {};
-            }
-        }
-      
-
-    private:
-
-        // Set chunk size of the MapView according to granularity
-        const DWORD chunk_size = []
-        {
-            SYSTEM_INFO sysinfo = { 0 };
-            ::GetSystemInfo(&sysinfo);
-            return sysinfo.dwAllocationGranularity;
-        }();
-
-        // Size of the current chunk , for the last it may be less than chunk_size
-        DWORD  current_chunk_size{};
-        HANDLE hFile = INVALID_HANDLE_VALUE;
-        HANDLE hMapFile{};
-        unsigned long long file_size{};
-        // the sequence number of the current byte in the file
-        unsigned long long current_pos{};
-        // Pointer to the beginning of mapped memory
-        const char* map_view{};
-        const char* pos_map_view{};
-        unsigned long long offset{};
-        bool is_open{};
-        // Current line buffer
-        SimpleString current_line;
-    };
+        // Size of the fragments of a long line passed to Fun
+        constexpr size_t fragment_size = 0x1000;
+        // Templates are made of the heads of the lines of this size
+        constexpr size_t max_template_size = 0x200;
+    }
 
     CLogReader::CLogReader(const char* filter) :
         text_file(new CTextFile),
         reg_exp(new CSimpleRegexp(filter))
-    {}
+    {
+        if (filter)
+            filter_text = filter;
+    }
 
     CLogReader::~CLogReader()
     {
@@ -208,6 +32,7 @@ namespace log_test
     bool CLogReader::Open(const char* file_name)
     {
         text_file->Open(file_name);
+        file_path = file_name;
         return text_file->IsOpen();
     }
 
@@ -217,9 +42,29 @@ namespace log_test
     }
 
     //   , false - 
-    bool CLogReader::SetFilter(const char* filter)
+    bool CLogReader::SetFilter(const char* filter, FilterSyntax syntax)
+    {
+        if (filter)
+            filter_text = filter;
+        filter_syntax = syntax;
+        return reg_exp->SetFilter(filter, syntax);
+    }
+
+    void CLogReader::SetMaxLineSize(size_t size)
+    {
+        text_file->SetMaxLineSize(size);
+    }
+
+    void CLogReader::SetContext(size_t before, size_t after, GapFun gap_f)
     {
-        return reg_exp->SetFilter(filter);
+        context_before = before;
+        context_after = after;
+        gap_fun = gap_f;
+    }
+
+    size_t CLogReader::ReadAt(unsigned long long offset, char* buf, size_t size) const
+    {
+        return text_file->ReadAt(offset, buf, size);
     }
 
     bool CLogReader::GetNextLine(char* buf, const int bufsize)
@@ -232,27 +77,187 @@ namespace log_test
         {
             const auto* line = text_file->ReadLine();
             if (!line || !text_file->IsOpen()) return false;
-            if (reg_exp->Match(line))
+            if (reg_exp->MatchPiece(line, strlen(line), text_file->IsLineBegin(), text_file->IsLineEnd()))
             {
-                CopyMemory(buf, line, (min(static_cast<size_t>(bufsize), strlen(line) + 1)));
+                if (text_file->IsLineBegin())
+                {
+                    CopyMemory(buf, line, (min(static_cast<size_t>(bufsize), strlen(line) + 1)));
+                    return true;
+                }
+                // The beginning of a long line
+                const auto size = static_cast<size_t>(min(static_cast<unsigned long long>(bufsize - 1), text_file->LineSize()));
+                buf[ReadAt(text_file->LineOffset(), buf, size)] = 0;
                 return true;
             }
         }
     }
 
-   void CLogReader::Enumerate(Fun f)
+    /*********************************************************************************************
+    /*
+    /* Passes the matched lines and the lines around them to the functors. The lines before a match
+    /* are kept in a ring as their offsets and sizes only and are read back from the file in one go
+    /* when a match comes, the lines after a match are passed as soon as they are read. A line is
+    /* passed once, so the windows of the matches close to each other are merged.
+    /*
+    /*********************************************************************************************/
+    class ContextHelper
+    {
+    public:
+        ContextHelper(const CLogReader* p_log_reader, Fun f, LongLineFun long_line_f)
+            : log_reader(p_log_reader)
+            , fun(f)
+            , long_line_fun(long_line_f)
+            , has_context(p_log_reader->context_before || p_log_reader->context_after)
+        {
+            if (!ring.Resize(log_reader->context_before))
+            {
+                print_last_error("Bad alloc");
+            }
+        }
+
+        // Takes every piece read with the result of its matching
+        void OnPiece(const char* text, bool is_line_begin, bool is_line_end, unsigned long long line_offset, unsigned long long line_size, bool is_match)
+        {
+            // The result of the matching comes with the last piece of a line
+            if (!is_line_end) return;
+            const auto line_number = line_count++;
+            if (is_match)
+            {
+                PassBefore(line_number);
+                PassLine(text, is_line_begin, line_offset, line_size, line_number);
+                after_left = log_reader->context_after;
+                return;
+            }
+            if (after_left)
+            {
+                --after_left;
+                PassLine(text, is_line_begin, line_offset, line_size, line_number);
+                return;
+            }
+            if (ring.IsEmpty()) return;
+
+            const ContextLine context_line{ line_offset, line_size };
+            if (ring_size < ring.Size())
+            {
+                ring[(ring_start + ring_size++) % ring.Size()] = context_line;
+                return;
+            }
+            ring[ring_start] = context_line;
+            ring_start = (ring_start + 1) % ring.Size();
+        }
+
+    private:
+        void PassLine(const char* text, bool is_whole, unsigned long long line_offset, unsigned long long line_size, unsigned long long line_number)
+        {
+            if (has_context && passed_count && line_number != last_passed + 1 && log_reader->gap_fun)
+                log_reader->gap_fun();
+            last_passed = line_number;
+            ++passed_count;
+
+            if (is_whole)
+                fun(text, strlen(text));
+            else
+                log_reader->PassLongLine(fun, long_line_fun, line_offset, line_size);
+        }
+
+        // The ring holds the lines right before the line_number, they follow each other in the file
+        void PassBefore(unsigned long long line_number)
+        {
+            const size_t max_line_size = log_reader->text_file->MaxLineSize();
+            auto first_number = line_number - ring_size;
+            for (size_t i{}; i < ring_size;)
+            {
+                const auto& first = ring[(ring_start + i) % ring.Size()];
+                if (first.size > max_line_size)
+                {
+                    PassLine(nullptr, false, first.offset, first.size, first_number++);
+                    ++i;
+                    continue;
+                }
+
+                // A run of the lines which are not long is read at once
+                size_t run_end = i + 1;
+                auto run_size = first.size;
+                for (; run_end < ring_size; ++run_end)
+                {
+                    const auto& next = ring[(ring_start + run_end) % ring.Size()];
+                    if (next.size > max_line_size) break;
+                    run_size = next.offset + next.size - first.offset;
+                }
+                if (!buffer.Resize(static_cast<size_t>(run_size) + 1))
+                {
+                    print_last_error("Bad alloc");
+                    break;
+                }
+                buffer.Data()[log_reader->ReadAt(first.offset, buffer.Data(), static_cast<size_t>(run_size))] = 0;
+
+                for (; i < run_end; ++i)
+                {
+                    const auto& line = ring[(ring_start + i) % ring.Size()];
+                    auto* text = buffer.Data() + (line.offset - first.offset);
+                    // Cuts off the \r\n
+                    text[line.size] = 0;
+                    PassLine(text, true, line.offset, line.size, first_number++);
+                }
+            }
+            ring_start = 0;
+            ring_size = 0;
+        }
+
+    private:
+        struct ContextLine
+        {
+            unsigned long long offset;
+            unsigned long long size;
+        };
+
+        const CLogReader* log_reader;
+        Fun fun;
+        LongLineFun long_line_fun;
+        bool has_context;
+
+        SimpleArray<ContextLine> ring;
+        size_t ring_start{};
+        size_t ring_size{};
+        SimpleArray<char> buffer;
+
+        unsigned long long line_count{};
+        unsigned long long last_passed{};
+        unsigned long long passed_count{};
+        size_t after_left{};
+    };
+
+   void CLogReader::Enumerate(Fun f, LongLineFun long_line_f)
     {
         if (!text_file->IsOpen()) return;
         if (!reg_exp->IsOk()) return;
 
+        ContextHelper context(this, f, long_line_f);
         for (;;)
         {
             const auto* line = text_file->ReadLine();
             if (!line || !text_file->IsOpen()) return;
-            if (reg_exp->Match(line))
-            {
-                f(line, strlen(line));
-            }
+            const bool is_match = reg_exp->MatchPiece(line, strlen(line), text_file->IsLineBegin(), text_file->IsLineEnd());
+            context.OnPiece(line, text_file->IsLineBegin(), text_file->IsLineEnd(), text_file->LineOffset(), text_file->LineSize(), is_match);
+        }
+    }
+
+    void CLogReader::PassLongLine(Fun f, LongLineFun long_line_f, unsigned long long offset, unsigned long long size) const
+    {
+        if (long_line_f)
+        {
+            long_line_f(offset, size);
+            return;
+        }
+        char fragment[fragment_size + 1];
+        while (size)
+        {
+            const auto part = ReadAt(offset, fragment, static_cast<size_t>(min(static_cast<unsigned long long>(fragment_size), size)));
+            if (!part) return;
+            fragment[part] = 0;
+            f(fragment, part);
+            offset += part;
+            size -= part;
         }
     }
 }
@@ -263,9 +268,10 @@ namespace log_test
     class AsyncEnumerateHelper
     {
     public:
-        AsyncEnumerateHelper(CLogReader *p_log_reader, Fun f)
+        AsyncEnumerateHelper(CLogReader *p_log_reader, Fun f, LongLineFun long_line_f)
             : log_reader(p_log_reader)
             , fun(f)
+            , long_line_fun(long_line_f)
             , stop(false)
         {
             
@@ -286,6 +292,7 @@ namespace log_test
             EnterCriticalSection(&buffer_lock);
             stop = true;
             LeaveCriticalSection(&buffer_lock);
+            WakeConditionVariable(&buffer_not_empty);
             WaitForSingleObject(hMatch, INFINITE);
         }
     private:
@@ -312,7 +319,12 @@ namespace log_test
                     break;
                 }
 
-                circular_buffer[(queue_start_offset + queue_size) % BUFFER_SIZE] = line;
+                auto& piece = circular_buffer[(queue_start_offset + queue_size) % BUFFER_SIZE];
+                piece.text = line;
+                piece.is_line_begin = log_reader->text_file->IsLineBegin();
+                piece.is_line_end = log_reader->text_file->IsLineEnd();
+                piece.line_offset = log_reader->text_file->LineOffset();
+                piece.line_size = log_reader->text_file->LineSize();
                 ++queue_size;
                 LeaveCriticalSection(&buffer_lock);
                 WakeConditionVariable(&buffer_not_empty);
@@ -328,7 +340,8 @@ namespace log_test
 
         unsigned MatchLines()
         {
-            SimpleString current_line;
+            LinePiece current_line;
+            ContextHelper context(log_reader, fun, long_line_fun);
             while (true)
             {
                 EnterCriticalSection(&buffer_lock);
@@ -357,11 +370,9 @@ namespace log_test
                 LeaveCriticalSection(&buffer_lock);
 
                 WakeConditionVariable(&buffer_not_full);
-                const auto* line = current_line.Data();
-                if (log_reader->reg_exp->Match(line))
-                {
-                    fun(line, strlen(line));
-                }
+                const auto* line = current_line.text.Data();
+                const bool is_match = log_reader->reg_exp->MatchPiece(line, strlen(line), current_line.is_line_begin, current_line.is_line_end);
+                context.OnPiece(line, current_line.is_line_begin, current_line.is_line_end, current_line.line_offset, current_line.line_size, is_match);
             }
 
             return 0;
@@ -377,9 +388,20 @@ namespace log_test
     private:   
         CLogReader* log_reader;
         Fun fun;
+        LongLineFun long_line_fun;
         static constexpr size_t BUFFER_SIZE = 100;
+
+        // A line or a piece of a long line
+        struct LinePiece
+        {
+            SimpleString text;
+            bool is_line_begin{};
+            bool is_line_end{};
+            unsigned long long line_offset{};
+            unsigned long long line_size{};
+        };
         
-        SimpleString circular_buffer[BUFFER_SIZE];
+        LinePiece circular_buffer[BUFFER_SIZE];
 
         size_t queue_size{};
         size_t queue_start_offset{};
@@ -390,9 +412,174 @@ namespace log_test
         bool stop;
     };
 
-    void CLogReader::AsyncEnumerate(Fun f)
+    void CLogReader::AsyncEnumerate(Fun f, LongLineFun long_line_f)
     {
-        AsyncEnumerateHelper helper(this, f);
+        AsyncEnumerateHelper helper(this, f, long_line_f);
         helper.process();
     }
+
+    /*********************************************************************************************
+    /*
+    /* The file is split into ranges, one per processor. A line belongs to the range where it
+    /* starts: every thread skips the line which comes from the previous range and reads past the
+    /* end of its own range to finish its last line. The threads open the file themselves,
+    /* match the lines with their own filters and count them in their own tables, which are
+    /* merged when all the threads are done.
+    /*
+    /*********************************************************************************************/
+    class AggregateHelper
+    {
+    public:
+        enum class KeyKind
+        {
+            Prefix,
+            Template
+        };
+
+        AggregateHelper(CLogReader* p_log_reader, KeyKind kind, size_t size)
+            : log_reader(p_log_reader)
+            , key_kind(kind)
+            , key_size_limit(kind == KeyKind::Prefix ? size : max_template_size)
+        {
+        }
+
+        bool process(CCountTable& counts)
+        {
+            if (!log_reader->text_file->IsOpen()) return false;
+            if (!log_reader->reg_exp->IsOk()) return false;
+
+            SYSTEM_INFO sysinfo = { 0 };
+            ::GetSystemInfo(&sysinfo);
+            const auto file_size = log_reader->text_file->Size();
+            size_t range_count = min(max(static_cast<size_t>(sysinfo.dwNumberOfProcessors), static_cast<size_t>(1)), MAX_RANGES);
+            range_count = static_cast<size_t>(min(static_cast<unsigned long long>(range_count), file_size / MIN_RANGE_SIZE + 1));
+
+            HANDLE threads[MAX_RANGES] = {};
+            for (size_t i{}; i < range_count; ++i)
+            {
+                ranges[i].helper = this;
+                ranges[i].begin = file_size * i / range_count;
+                ranges[i].end = file_size * (i + 1) / range_count;
+                threads[i] = reinterpret_cast<HANDLE>(_beginthreadex(0, 0, ScanRangeThreadProc, &ranges[i], 0, 0));
+                if (!threads[i])
+                {
+                    print_last_error("_beginthreadex");
+                    ranges[i].failed = true;
+                }
+            }
+
+            bool result = true;
+            for (size_t i{}; i < range_count; ++i)
+            {
+                if (threads[i])
+                {
+                    WaitForSingleObject(threads[i], INFINITE);
+                    CloseHandle(threads[i]);
+                }
+                result = result && !ranges[i].failed && counts.Merge(ranges[i].counts);
+            }
+            return result;
+        }
+
+    private:
+        struct Range
+        {
+            AggregateHelper* helper;
+            unsigned long long begin;
+            unsigned long long end;
+            CCountTable counts;
+            bool failed;
+        };
+
+        unsigned ScanRange(Range& range)
+        {
+            CTextFile text_file;
+            text_file.SetMaxLineSize(log_reader->text_file->MaxLineSize());
+            text_file.Open(log_reader->file_path.Data());
+            // The filter keeps matching state, so every thread has its own one
+            CSimpleRegexp reg_exp(log_reader->filter_text.Data(), log_reader->filter_syntax);
+            // The head of the line is gathered from its pieces, the key is made when the line is matched
+            SimpleArray<char> head;
+            SimpleArray<char> key;
+            if (!text_file.IsOpen() || !reg_exp.IsOk() || !head.Resize(key_size_limit + 1) || !key.Resize(key_size_limit + 1))
+            {
+                range.failed = true;
+                return 0;
+            }
+
+            if (range.begin)
+            {
+                // Any line which starts in the range follows the first \r\n at or after begin - 2
+                text_file.Seek(range.begin < 2 ? 0 : range.begin - 2);
+                while (text_file.ReadLine() && !text_file.IsLineEnd())
+                {
+                }
+            }
+
+            size_t head_size{};
+            for (;;)
+            {
+                const auto* line = text_file.ReadLine();
+                if (!line || !text_file.IsOpen()) break;
+                const size_t line_size = strlen(line);
+                if (text_file.IsLineBegin())
+                {
+                    if (text_file.LineOffset() >= range.end) break;
+                    head_size = 0;
+                }
+                const size_t head_part = min(line_size, key_size_limit - head_size);
+                CopyMemory(head.Data() + head_size, line, head_part);
+                head_size += head_part;
+                if (!reg_exp.MatchPiece(line, line_size, text_file.IsLineBegin(), text_file.IsLineEnd())) continue;
+
+                const char* key_data = head.Data();
+                size_t key_size = head_size;
+                if (key_kind == KeyKind::Template)
+                {
+                    key_size = MaskTemplate(head.Data(), head_size, key.Data(), key_size_limit);
+                    key_data = key.Data();
+                }
+                if (!range.counts.Add(key_data, key_size))
+                {
+                    range.failed = true;
+                    break;
+                }
+            }
+            return 0;
+        }
+
+        static unsigned WINAPI ScanRangeThreadProc(void* data)
+        {
+            auto* range = reinterpret_cast<Range*>(data);
+            return range->helper->ScanRange(*range);
+        }
+
+    private:
+        static constexpr size_t MAX_RANGES = 64;
+        // Smaller files are not worth more threads
+        static constexpr unsigned long long MIN_RANGE_SIZE = 0x100000;
+
+        CLogReader* log_reader;
+        KeyKind key_kind;
+        size_t key_size_limit;
+        Range ranges[MAX_RANGES] = {};
+    };
+
+    bool CLogReader::CountByPrefix(size_t prefix_size, CountFun f)
+    {
+        CCountTable counts;
+        AggregateHelper helper(this, AggregateHelper::KeyKind::Prefix, prefix_size);
+        if (!helper.process(counts)) return false;
+        counts.EnumerateByKey(f);
+        return true;
+    }
+
+    bool CLogReader::TopTemplates(size_t top_count, CountFun f)
+    {
+        CCountTable counts;
+        AggregateHelper helper(this, AggregateHelper::KeyKind::Template, 0);
+        if (!helper.process(counts)) return false;
+        counts.EnumerateTop(top_count, f);
+        return true;
+    }
 }
\ No newline at end of file
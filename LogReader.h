@@ -1,14 +1,26 @@
 #pragma once
 #include <windows.h>
+#include "Aggregation.h"
 #include "Utilities.h"
 
 namespace log_test
 {
     using Fun = void(*)(const char* buf, size_t bufsize);
+    // Receives a matched line longer than the max line size as its offset and size in the file
+    using LongLineFun = void(*)(unsigned long long offset, unsigned long long size);
+    // Called between two windows of context lines which are apart in the file
+    using GapFun = void(*)();
     class CLogReader final
     {
         class CTextFile* text_file{};
         class CSimpleRegexp* reg_exp{};
+        // The scan threads of the aggregations open the file and compile the filter again
+        SimpleString file_path;
+        SimpleString filter_text;
+        FilterSyntax filter_syntax{};
+        size_t context_before{};
+        size_t context_after{};
+        GapFun gap_fun{};
 
         CLogReader(CLogReader&) = delete;
         CLogReader(CLogReader&&) = delete;
@@ -25,18 +37,45 @@ namespace log_test
 
         void Close();
 
-        // // Sets a new wildcard
-        bool SetFilter(const char* filter);  
+        // // Sets a new wildcard or regular expression
+        bool SetFilter(const char* filter, FilterSyntax syntax = FilterSyntax::Wildcard);  
+
+        // Lines longer than the size are matched piece by piece and never kept in memory as a whole, 1 MB by default
+        void SetMaxLineSize(size_t size);
+
+        // Enumerate and AsyncEnumerate pass the before lines preceding and the after lines following each matched line as well,
+        // the overlapping windows are merged so every line is passed once, gap_f is called between the windows which are apart
+        void SetContext(size_t before, size_t after, GapFun gap_f = nullptr);
+
+        // Copies the bytes of the open file at the offset, returns the number of bytes copied
+        size_t ReadAt(unsigned long long offset, char* buf, size_t size) const;
 
         // Get a line from a file that matches the pattern, if there are no lines then return false
         bool GetNextLine(char* buf, const int bufsize);
 
-        // Injecting a functor which is called each time a line is found which matches the pattern
-        void Enumerate(Fun f);
+        // Injecting a functor which is called each time a line is found which matches the pattern,
+        // a matched line longer than the max line size goes to long_line_f, without it the line goes to f in fragments
+        void Enumerate(Fun f, LongLineFun long_line_f = nullptr);
         // Injecting a functor which is called each time a line is found which matches the pattern(Async);
-        void AsyncEnumerate(Fun f);
+        void AsyncEnumerate(Fun f, LongLineFun long_line_f = nullptr);
+
+        // Aggregations over the matched lines of the whole file, GetNextLine does not affect them.
+        // The file is scanned by several threads, each one counts in its own table, the tables are merged at the end.
+
+        // Counts the matched lines by their first prefix_size bytes, a timestamp cut to the minute for example,
+        // the functor is called in the order of the prefixes
+        bool CountByPrefix(size_t prefix_size, CountFun f);
+
+        // Counts the matched lines by the templates of their heads, where numbers and hexadecimal words are masked,
+        // the functor is called for the top_count most frequent ones, the most frequent first
+        bool TopTemplates(size_t top_count, CountFun f);
     private:
+        // Passes a matched line longer than the max line size to the functors
+        void PassLongLine(Fun f, LongLineFun long_line_f, unsigned long long offset, unsigned long long size) const;
+
         //Our asynchronous friend
         friend class AsyncEnumerateHelper;
+        friend class AggregateHelper;
+        friend class ContextHelper;
     };
 }
@@ -0,0 +1,786 @@
+#include <winsock2.h>
+#include <afunix.h>
+#include "LogServer.h"
+#include "SimpleRegexp.h"
+#include "TextFile.h"
+#include <process.h>
+
+#pragma comment(lib, "Ws2_32.lib")
+
+namespace log_test
+{
+    namespace
+    {
+        // The request is three null-terminated strings, the file name, the filter syntax and the filter
+        constexpr size_t request_size = 0x10000;
+        constexpr size_t request_fields = 3;
+        constexpr char wildcard_syntax[] = "w";
+        constexpr char regexp_syntax[] = "r";
+        constexpr char status_accepted = '1';
+        constexpr char status_rejected = '0';
+        // A client which does not read for so long in ms is dropped
+        constexpr DWORD client_timeout = 2000;
+        // How long in ms the scan waits for a slow client at a time when it has no other queries
+        constexpr DWORD park_wait = 100;
+
+        bool SendAll(SOCKET s, const char* data, size_t size)
+        {
+            while (size)
+            {
+                const int sent = send(s, data, static_cast<int>(min(size, static_cast<size_t>(0x40000000))), 0);
+                if (sent == SOCKET_ERROR) return false;
+                data += sent;
+                size -= sent;
+            }
+            return true;
+        }
+
+        bool RecvAll(SOCKET s, char* data, size_t size)
+        {
+            while (size)
+            {
+                const int received = recv(s, data, static_cast<int>(min(size, static_cast<size_t>(0x40000000))), 0);
+                if (received == SOCKET_ERROR || !received) return false;
+                data += received;
+                size -= received;
+            }
+            return true;
+        }
+
+        bool MakeAddress(const char* socket_path, sockaddr_un& address)
+        {
+            const size_t path_size = strlen(socket_path);
+            if (!path_size || path_size >= sizeof(address.sun_path))
+            {
+                print_last_error("Bad socket path");
+                return false;
+            }
+            ZeroMemory(&address, sizeof(address));
+            address.sun_family = AF_UNIX;
+            CopyMemory(address.sun_path, socket_path, path_size);
+            return true;
+        }
+    }
+
+    // A query of one client attached to the shared scan of a file. The scan thread puts the matched lines
+    // to a bounded buffer and the thread of the client sends them. When the buffer is full the scan parks
+    // the query instead of waiting, only a line which never fits the buffer is put with waiting
+    // for client_timeout at most
+    struct ScanQuery final
+    {
+        ScanQuery(SOCKET s, const char* filter, FilterSyntax syntax)
+            : client(s)
+            , reg_exp(filter, syntax)
+            , buffer(static_cast<char*>(HeapAlloc(GetProcessHeap(), 0, buffer_size)))
+        {
+            InitializeCriticalSection(&buffer_lock);
+            InitializeConditionVariable(&buffer_not_empty);
+            InitializeConditionVariable(&buffer_not_full);
+            if (!buffer)
+            {
+                print_last_error("Bad alloc");
+                return;
+            }
+            buffer[used++] = status_accepted;
+        }
+
+        ~ScanQuery()
+        {
+            if (buffer) HeapFree(GetProcessHeap(), 0, buffer);
+            DeleteCriticalSection(&buffer_lock);
+        }
+
+        bool IsOk() const
+        {
+            return buffer && reg_exp.IsOk();
+        }
+
+        // Puts a matched line to the buffer, false if the client is gone
+        bool Send(const char* line, size_t size)
+        {
+            const auto frame_size = static_cast<UINT32>(size);
+            return Put(reinterpret_cast<const char*>(&frame_size), sizeof(frame_size)) && Put(line, size);
+        }
+
+        // Puts a matched line longer than the max line size to the buffer, reading it from the file part by part
+        bool SendLong(const CTextFile& file, unsigned long long offset, unsigned long long size)
+        {
+            // A frame cannot be longer
+            const auto frame_size = static_cast<UINT32>(min(size, static_cast<unsigned long long>(MAXUINT32)));
+            if (!Put(reinterpret_cast<const char*>(&frame_size), sizeof(frame_size))) return false;
+            for (size_t left = frame_size; left;)
+            {
+                const size_t part = min(left, read_buffer_size);
+                if (file.ReadAt(offset, read_buffer, part) != part || !Put(read_buffer, part)) return false;
+                offset += part;
+                left -= part;
+            }
+            return true;
+        }
+
+        // True if a line of the size can be put without waiting, a line which never fits the buffer always can
+        bool HasRoom(size_t size)
+        {
+            const size_t frame_size = sizeof(UINT32) + size;
+            if (frame_size > buffer_size) return true;
+            EnterCriticalSection(&buffer_lock);
+            const bool result = gone || buffer_size - used >= frame_size;
+            LeaveCriticalSection(&buffer_lock);
+            return result;
+        }
+
+        // Waits up to the timeout until the client has read half of the buffer, true if the query can go on
+        bool WaitForRoom(DWORD timeout)
+        {
+            EnterCriticalSection(&buffer_lock);
+            while (!gone && used > buffer_size / 2 && SleepConditionVariableCS(&buffer_not_full, &buffer_lock, timeout))
+            {
+            }
+            const bool result = gone || used <= buffer_size / 2;
+            LeaveCriticalSection(&buffer_lock);
+            return result;
+        }
+
+        // Called by the scan thread when it is done with the query, the query is not touched by it afterwards
+        void Finish()
+        {
+            EnterCriticalSection(&buffer_lock);
+            finished = true;
+            // Under the lock, the client thread may delete the query as soon as it sees finished
+            WakeConditionVariable(&buffer_not_empty);
+            LeaveCriticalSection(&buffer_lock);
+        }
+
+        // Sends the buffer to the client until the query is finished
+        void Drain()
+        {
+            EnterCriticalSection(&buffer_lock);
+            for (;;)
+            {
+                while (!finished && (!used || gone))
+                {
+                    SleepConditionVariableCS(&buffer_not_empty, &buffer_lock, INFINITE);
+                }
+                if (finished && (!used || gone)) break;
+
+                // The scan thread only writes past the used bytes
+                const size_t part = min(used, buffer_size - begin);
+                LeaveCriticalSection(&buffer_lock);
+                const bool sent = SendAll(client, buffer + begin, part);
+                EnterCriticalSection(&buffer_lock);
+                begin = (begin + part) % buffer_size;
+                used -= part;
+                gone = gone || !sent;
+                WakeConditionVariable(&buffer_not_full);
+            }
+            LeaveCriticalSection(&buffer_lock);
+        }
+
+        SOCKET client;
+        CSimpleRegexp reg_exp;
+        // Bytes of the file the query has not seen yet, it is complete when the scan has made a full circle
+        unsigned long long unseen{};
+        // The offset of the line a parked query goes on from
+        unsigned long long resume{};
+        bool failed{};
+        ScanQuery* next{};
+
+    private:
+        // Copies the bytes to the buffer waiting for room, false if the client is gone or has not read for client_timeout
+        bool Put(const char* data, size_t size)
+        {
+            EnterCriticalSection(&buffer_lock);
+            while (size && !gone)
+            {
+                if (used == buffer_size && !SleepConditionVariableCS(&buffer_not_full, &buffer_lock, client_timeout))
+                {
+                    gone = true;
+                    break;
+                }
+                const size_t end = (begin + used) % buffer_size;
+                const size_t part = min(size, min(buffer_size - used, buffer_size - end));
+                CopyMemory(buffer + end, data, part);
+                used += part;
+                data += part;
+                size -= part;
+                WakeConditionVariable(&buffer_not_empty);
+            }
+            const bool result = !gone;
+            LeaveCriticalSection(&buffer_lock);
+            return result;
+        }
+
+    private:
+        static constexpr size_t buffer_size = 0x100000;
+        static constexpr size_t read_buffer_size = 0x10000;
+
+        // A circular buffer of the bytes to send
+        char* buffer;
+        size_t begin{};
+        size_t used{};
+        bool finished{};
+        // The client has disconnected or does not read
+        bool gone{};
+        CRITICAL_SECTION buffer_lock;
+        CONDITION_VARIABLE buffer_not_empty;
+        CONDITION_VARIABLE buffer_not_full;
+
+        // Only the scan thread uses it
+        char read_buffer[read_buffer_size];
+    };
+
+    /*********************************************************************************************
+    /*
+    /* One scan thread per file reads it in a circle while there are queries. Joining queries
+    /* are attached between batches of lines, a query is complete when the scan has wrapped
+    /* around and returned to the line it started from. A line longer than the max line size
+    /* comes in pieces, the queries are attached only at the beginning of a line. A query whose
+    /* client is behind is parked at a line and goes on from it when the scan comes back there.
+    /* The file is released when the scan runs out of queries and is opened again by the next one.
+    /*
+    /*********************************************************************************************/
+    class CSharedScan final
+    {
+    public:
+        CSharedScan(const char* name, size_t max_line_size)
+        {
+            file_name = name;
+            InitializeCriticalSection(&scan_lock);
+            text_file.SetMaxLineSize(max_line_size);
+            text_file.Open(name);
+        }
+
+        ~CSharedScan()
+        {
+            Stop();
+            if (scan_thread)
+            {
+                WaitForSingleObject(scan_thread, INFINITE);
+                CloseHandle(scan_thread);
+            }
+            DeleteCriticalSection(&scan_lock);
+        }
+
+        bool IsOpen() const
+        {
+            return text_file.IsOpen();
+        }
+
+        bool IsFile(const char* name) const
+        {
+            return !_stricmp(file_name.Data(), name);
+        }
+
+        // Adds the query to the scan, it is finished when it has seen every line, false if the scan cannot be started
+        bool Join(ScanQuery* query)
+        {
+            EnterCriticalSection(&scan_lock);
+            const bool result = running || StartScan();
+            if (result)
+            {
+                query->next = pending;
+                pending = query;
+            }
+            LeaveCriticalSection(&scan_lock);
+            return result;
+        }
+
+        // Completes all queries, the scan cannot be started again
+        void Stop()
+        {
+            EnterCriticalSection(&scan_lock);
+            stop = true;
+            LeaveCriticalSection(&scan_lock);
+        }
+
+        CSharedScan* next{};
+        // The clients which use the scan, under the lock of the server
+        size_t users{};
+
+    private:
+        // Called under the lock
+        bool StartScan()
+        {
+            if (stop) return false;
+            if (scan_thread)
+            {
+                // The previous scan has already left the lock for good
+                WaitForSingleObject(scan_thread, INFINITE);
+                CloseHandle(scan_thread);
+                scan_thread = {};
+            }
+            if (!text_file.IsOpen() || text_file.SizeChanged())
+            {
+                text_file.Open(file_name.Data());
+            }
+            if (!text_file.IsOpen()) return false;
+
+            scan_thread = reinterpret_cast<HANDLE>(_beginthreadex(0, 0, ScanThreadProc, this, 0, 0));
+            if (!scan_thread)
+            {
+                print_last_error("_beginthreadex");
+                return false;
+            }
+            running = true;
+            return true;
+        }
+
+        unsigned Scan()
+        {
+            static constexpr size_t batch_size = 1024;
+            for (;;)
+            {
+                EnterCriticalSection(&scan_lock);
+                if (stop)
+                {
+                    CompleteAll(pending);
+                    CompleteAll(active);
+                    CompleteAll(parked);
+                }
+                // In the middle of a long line the pending queries wait for its end
+                while (pending && text_file.IsLineEnd())
+                {
+                    auto* query = pending;
+                    pending = query->next;
+                    query->unseen = text_file.Size();
+                    query->next = active;
+                    active = query;
+                }
+                if (!active && !pending && !parked)
+                {
+                    // Log writers may rename or delete the file until the next query
+                    text_file.Reset();
+                    running = false;
+                    LeaveCriticalSection(&scan_lock);
+                    return 0;
+                }
+                LeaveCriticalSection(&scan_lock);
+
+                if (!active && parked && text_file.IsLineEnd())
+                {
+                    // Only the queries of slow clients are left, the scan goes back to where the first one has stopped
+                    if (parked->WaitForRoom(park_wait))
+                    {
+                        text_file.Seek(parked->resume);
+                        Resume(parked->resume);
+                    }
+                    continue;
+                }
+
+                // Without active queries the scan only goes on to the end of the line
+                for (size_t i{}; i < batch_size && (active || !text_file.IsLineEnd()); ++i)
+                {
+                    if (text_file.Eof())
+                    {
+                        text_file.Rewind();
+                    }
+                    if (parked && text_file.IsLineEnd())
+                    {
+                        Resume(text_file.Tell());
+                    }
+
+                    const auto pos = text_file.Tell();
+                    const auto* line = text_file.ReadLine();
+                    if (!line || !text_file.IsOpen())
+                    {
+                        for (auto* query = active; query; query = query->next)
+                        {
+                            query->failed = true;
+                        }
+                        for (auto* query = parked; query; query = query->next)
+                        {
+                            query->failed = true;
+                        }
+                        CompleteAll(active);
+                        CompleteAll(parked);
+                        break;
+                    }
+
+                    const size_t line_size = strlen(line);
+                    const auto consumed = text_file.Tell() - pos;
+                    const bool is_line_begin = text_file.IsLineBegin();
+                    const bool is_line_end = text_file.IsLineEnd();
+                    for (auto** link = &active; *link;)
+                    {
+                        auto* query = *link;
+                        if (query->reg_exp.MatchPiece(line, line_size, is_line_begin, is_line_end))
+                        {
+                            if (is_line_begin && !query->HasRoom(line_size))
+                            {
+                                // The client is behind, the query goes on from this line in a later pass
+                                *link = query->next;
+                                query->resume = pos;
+                                query->next = parked;
+                                parked = query;
+                                continue;
+                            }
+                            if (!(is_line_begin
+                                ? query->Send(line, line_size)
+                                : query->SendLong(text_file, text_file.LineOffset(), text_file.LineSize())))
+                            {
+                                // The client has disconnected
+                                query->failed = true;
+                            }
+                        }
+                        query->unseen -= consumed;
+                        if (query->failed || !query->unseen)
+                        {
+                            *link = query->next;
+                            Complete(query);
+                            continue;
+                        }
+                        link = &query->next;
+                    }
+                }
+            }
+        }
+
+        static unsigned WINAPI ScanThreadProc(void* data)
+        {
+            auto* this_ = reinterpret_cast<CSharedScan*>(data);
+            return this_->Scan();
+        }
+
+        // Moves the parked queries which have stopped at the line and whose clients have caught up back to the scan
+        void Resume(unsigned long long pos)
+        {
+            for (auto** link = &parked; *link;)
+            {
+                auto* query = *link;
+                if (query->resume == pos && query->WaitForRoom(0))
+                {
+                    *link = query->next;
+                    query->next = active;
+                    active = query;
+                    continue;
+                }
+                link = &query->next;
+            }
+        }
+
+        void Complete(ScanQuery* query)
+        {
+            query->Finish();
+        }
+
+        void CompleteAll(ScanQuery*& list)
+        {
+            while (list)
+            {
+                auto* query = list;
+                list = query->next;
+                Complete(query);
+            }
+        }
+
+    private:
+        SimpleString file_name;
+        CTextFile text_file;
+        // Queries waiting for the next batch
+        ScanQuery* pending{};
+        // Queries matched against every line, only the scan thread touches them
+        ScanQuery* active{};
+        // Queries of the clients which are behind, only the scan thread touches them
+        ScanQuery* parked{};
+        HANDLE scan_thread{};
+        bool running{};
+        bool stop{};
+        CRITICAL_SECTION scan_lock;
+    };
+
+    namespace
+    {
+        struct ClientContext
+        {
+            CLogServer* server;
+            SOCKET client;
+        };
+    }
+
+    CLogServer::CLogServer()
+        : listen_socket(INVALID_SOCKET)
+    {
+        InitializeCriticalSection(&server_lock);
+        InitializeConditionVariable(&no_clients);
+        WSADATA wsa_data{};
+        if (WSAStartup(MAKEWORD(2, 2), &wsa_data))
+        {
+            print_last_error("WSAStartup");
+        }
+    }
+
+    CLogServer::~CLogServer()
+    {
+        while (scans)
+        {
+            auto* scan = scans;
+            scans = scan->next;
+            delete scan;
+        }
+        WSACleanup();
+        DeleteCriticalSection(&server_lock);
+    }
+
+    bool CLogServer::Run(const char* socket_path)
+    {
+        sockaddr_un address{};
+        if (!MakeAddress(socket_path, address)) return false;
+
+        EnterCriticalSection(&server_lock);
+        listen_socket = stop ? INVALID_SOCKET : socket(AF_UNIX, SOCK_STREAM, 0);
+        LeaveCriticalSection(&server_lock);
+        if (listen_socket == INVALID_SOCKET)
+        {
+            print_last_error("socket");
+            return false;
+        }
+
+        // The socket file left by the previous run
+        DeleteFileA(socket_path);
+        if (bind(listen_socket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == SOCKET_ERROR
+            || listen(listen_socket, SOMAXCONN) == SOCKET_ERROR)
+        {
+            print_last_error("bind");
+            Stop();
+            return false;
+        }
+
+        for (;;)
+        {
+            // Stop closes the listening socket
+            const auto client = accept(listen_socket, nullptr, nullptr);
+            if (client == INVALID_SOCKET)
+            {
+                EnterCriticalSection(&server_lock);
+                const bool stopping = stop;
+                LeaveCriticalSection(&server_lock);
+                if (stopping) break;
+                // E.g. a client which has given up before it was accepted
+                print_last_error("accept");
+                continue;
+            }
+
+            EnterCriticalSection(&server_lock);
+            ++client_count;
+            LeaveCriticalSection(&server_lock);
+
+            auto* context = new ClientContext{ this, client };
+            HANDLE hClient = reinterpret_cast<HANDLE>(_beginthreadex(0, 0, ServeClientThreadProc, context, 0, 0));
+            if (!hClient)
+            {
+                print_last_error("_beginthreadex");
+                delete context;
+                closesocket(client);
+                EnterCriticalSection(&server_lock);
+                --client_count;
+                LeaveCriticalSection(&server_lock);
+                continue;
+            }
+            CloseHandle(hClient);
+        }
+
+        Stop();
+        EnterCriticalSection(&server_lock);
+        for (auto* scan = scans; scan; scan = scan->next)
+        {
+            scan->Stop();
+        }
+        while (client_count)
+        {
+            SleepConditionVariableCS(&no_clients, &server_lock, INFINITE);
+        }
+        LeaveCriticalSection(&server_lock);
+        DeleteFileA(socket_path);
+        return true;
+    }
+
+    void CLogServer::SetMaxLineSize(size_t size)
+    {
+        max_line_size = size;
+    }
+
+    void CLogServer::Stop()
+    {
+        EnterCriticalSection(&server_lock);
+        stop = true;
+        if (listen_socket != INVALID_SOCKET)
+        {
+            closesocket(listen_socket);
+            listen_socket = INVALID_SOCKET;
+        }
+        LeaveCriticalSection(&server_lock);
+    }
+
+    CSharedScan* CLogServer::GetScan(const char* file_name)
+    {
+        EnterCriticalSection(&server_lock);
+        auto* scan = scans;
+        while (scan && !scan->IsFile(file_name))
+        {
+            scan = scan->next;
+        }
+        if (!scan && !stop)
+        {
+            scan = new CSharedScan(file_name, max_line_size);
+            if (scan->IsOpen())
+            {
+                scan->next = scans;
+                scans = scan;
+            }
+            else
+            {
+                delete scan;
+                scan = nullptr;
+            }
+        }
+        if (scan)
+        {
+            ++scan->users;
+        }
+        LeaveCriticalSection(&server_lock);
+        return scan;
+    }
+
+    void CLogServer::ReleaseScan(CSharedScan* scan)
+    {
+        EnterCriticalSection(&server_lock);
+        if (!--scan->users)
+        {
+            auto** link = &scans;
+            while (*link != scan)
+            {
+                link = &(*link)->next;
+            }
+            *link = scan->next;
+            delete scan;
+        }
+        LeaveCriticalSection(&server_lock);
+    }
+
+    unsigned CLogServer::ServeClient(UINT_PTR client)
+    {
+        // Stop does not wait for a client which does not read or does not send its request
+        const DWORD timeout = client_timeout;
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+
+        char request[request_size];
+        size_t request_used{};
+        size_t terminators{};
+        while (terminators < request_fields && request_used < request_size)
+        {
+            const int received = recv(client, request + request_used, static_cast<int>(request_size - request_used), 0);
+            if (received == SOCKET_ERROR || !received) break;
+            for (int i{}; i < received; ++i)
+            {
+                if (!request[request_used + i]) ++terminators;
+            }
+            request_used += received;
+        }
+
+        if (terminators >= request_fields)
+        {
+            const char* file_name = request;
+            const char* syntax = file_name + strlen(file_name) + 1;
+            const char* filter = syntax + strlen(syntax) + 1;
+            auto* query = new ScanQuery(client, filter, strcmp(syntax, regexp_syntax) ? FilterSyntax::Wildcard : FilterSyntax::Regexp);
+            auto* scan = query->IsOk() ? GetScan(file_name) : nullptr;
+            if (scan && scan->Join(query))
+            {
+                query->Drain();
+            }
+            else
+            {
+                SendAll(client, &status_rejected, 1);
+            }
+            if (scan)
+            {
+                ReleaseScan(scan);
+            }
+            delete query;
+        }
+        closesocket(client);
+
+        EnterCriticalSection(&server_lock);
+        --client_count;
+        LeaveCriticalSection(&server_lock);
+        WakeAllConditionVariable(&no_clients);
+        return 0;
+    }
+
+    unsigned WINAPI CLogServer::ServeClientThreadProc(void* data)
+    {
+        const auto context = *reinterpret_cast<ClientContext*>(data);
+        delete reinterpret_cast<ClientContext*>(data);
+        return context.server->ServeClient(context.client);
+    }
+
+    bool QueryServer(const char* socket_path, const char* file_name, const char* filter, FilterSyntax syntax, Fun f)
+    {
+        sockaddr_un address{};
+        if (!filter || !MakeAddress(socket_path, address)) return false;
+
+        WSADATA wsa_data{};
+        if (WSAStartup(MAKEWORD(2, 2), &wsa_data))
+        {
+            print_last_error("WSAStartup");
+            return false;
+        }
+
+        bool result = false;
+        char* line{};
+        size_t line_alloc_size{};
+        const auto s = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (s == INVALID_SOCKET || connect(s, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == SOCKET_ERROR)
+        {
+            print_last_error("connect");
+        }
+        else
+        {
+            // The server resolves relative names against its own working directory
+            char full_name[MAX_PATH] = {};
+            const auto full_name_size = GetFullPathNameA(file_name, MAX_PATH, full_name, nullptr);
+            const char* request_name = full_name_size && full_name_size < MAX_PATH ? full_name : file_name;
+
+            char status = status_rejected;
+            const char* request_syntax = syntax == FilterSyntax::Regexp ? regexp_syntax : wildcard_syntax;
+            if (SendAll(s, request_name, strlen(request_name) + 1)
+                && SendAll(s, request_syntax, strlen(request_syntax) + 1)
+                && SendAll(s, filter, strlen(filter) + 1)
+                && RecvAll(s, &status, 1))
+            {
+                result = status == status_accepted;
+            }
+
+            UINT32 line_size{};
+            while (result && RecvAll(s, reinterpret_cast<char*>(&line_size), sizeof(line_size)))
+            {
+                if (line_size + 1 > line_alloc_size)
+                {
+                    if (line) HeapFree(GetProcessHeap(), 0, line);
+                    line_alloc_size = line_size + 1;
+                    line = static_cast<char*>(HeapAlloc(GetProcessHeap(), 0, line_alloc_size));
+                    if (!line)
+                    {
+                        print_last_error("Bad alloc");
+                        line_alloc_size = 0;
+                        result = false;
+                        break;
+                    }
+                }
+                if (!RecvAll(s, line, line_size))
+                {
+                    result = false;
+                    break;
+                }
+                line[line_size] = 0;
+                f(line, line_size);
+            }
+        }
+
+        if (line) HeapFree(GetProcessHeap(), 0, line);
+        if (s != INVALID_SOCKET) closesocket(s);
+        WSACleanup();
+        return result;
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include "LogReader.h"
+
+namespace log_test
+{
+    /*********************************************************************************************
+    /*
+    /* A long-running query daemon listening on a Unix domain socket.
+    /* A file stays mapped while it is queried. Concurrent queries against the same file join one
+    /* shared circular scan: every line is read once and checked against all active filters,
+    /* a query that joins in the middle of the file is completed after the scan wraps around.
+    /*
+    /* Protocol: the client sends the file name, the filter syntax ("w" - wildcard, "r" - regular
+    /* expression) and the filter as three null-terminated strings,
+    /* the server answers with one status byte ('1' - accepted, '0' - rejected) followed by
+    /* the matched lines, each one prefixed by its 32-bit length, and closes the connection.
+    /* A line longer than 4 GB is cut to that size.
+    /*
+    /*********************************************************************************************/
+    class CLogServer final
+    {
+        CLogServer(CLogServer&) = delete;
+        CLogServer(CLogServer&&) = delete;
+
+        CLogServer& operator=(CLogServer&) = delete;
+        CLogServer& operator=(CLogServer&&) = delete;
+
+    public:
+        CLogServer();
+        ~CLogServer();
+
+        // Listens on the socket path and serves clients until Stop is called
+        bool Run(const char* socket_path);
+
+        // Stops accepting clients and completes the running queries, can be called from any thread
+        void Stop();
+
+        // Lines longer than the size are matched piece by piece, set before Run
+        void SetMaxLineSize(size_t size);
+
+    private:
+        static constexpr size_t default_max_line_size = 0x100000;
+
+        // Finds the shared scan of the file or opens a new one, returns nullptr if the file cannot be opened
+        class CSharedScan* GetScan(const char* file_name);
+
+        // The scan is deleted when its last client is done
+        void ReleaseScan(class CSharedScan* scan);
+
+        // Reads the request of the client and waits until its query is complete
+        unsigned ServeClient(UINT_PTR client);
+        static unsigned WINAPI ServeClientThreadProc(void* data);
+
+    private:
+        UINT_PTR listen_socket;
+        bool stop{};
+        // The list of files which are being queried
+        class CSharedScan* scans{};
+        size_t client_count{};
+        size_t max_line_size = default_max_line_size;
+        CRITICAL_SECTION server_lock;
+        CONDITION_VARIABLE no_clients;
+    };
+
+    // Sends the query to the server and calls the functor for each line it returns
+    bool QueryServer(const char* socket_path, const char* file_name, const char* filter, FilterSyntax syntax, Fun f);
+}
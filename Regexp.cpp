@@ -0,0 +1,888 @@
+#include "Regexp.h"
+#include "Kernels.h"
+#include <stdlib.h>
+
+namespace log_test
+{
+    namespace
+    {
+        constexpr int max_repeat_count = 1000;
+        // The parser recurses once per group, deeper patterns are rejected before they exhaust the stack
+        constexpr size_t max_group_depth = 256;
+        constexpr size_t initial_index_size = 256;
+
+        int CompareStates(const void* left, const void* right)
+        {
+            return *static_cast<const int*>(left) - *static_cast<const int*>(right);
+        }
+
+        unsigned HashStates(const int* states, size_t size, bool at_begin)
+        {
+            unsigned hash = at_begin ? 2166136261u : 84696351u;
+            for (size_t i{}; i < size; ++i)
+            {
+                hash = (hash ^ static_cast<unsigned>(states[i])) * 16777619u;
+            }
+            return hash;
+        }
+
+        void CopyLiteral(char* destination, size_t& destination_size, const char* source, size_t source_size, size_t max_size)
+        {
+            destination_size = min(source_size, max_size);
+            CopyMemory(destination, source, destination_size);
+        }
+
+        // Keeps the longer of two required literals
+        void KeepLonger(char* required, size_t& required_size, const char* candidate, size_t candidate_size, size_t max_size)
+        {
+            if (min(candidate_size, max_size) > required_size)
+            {
+                CopyLiteral(required, required_size, candidate, candidate_size, max_size);
+            }
+        }
+
+        bool IsDigit(char ch)
+        {
+            return ch >= '0' && ch <= '9';
+        }
+
+        int HexValue(char ch)
+        {
+            if (IsDigit(ch)) return ch - '0';
+            if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+            if (ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+            return -1;
+        }
+    }
+
+    bool CRegexp::Compile(const char* new_pattern)
+    {
+        is_ok = false;
+        nfa.Reset();
+        byte_sets.Reset();
+        required_size = 0;
+        FlushCache();
+        if (!new_pattern) return false;
+
+        pattern = new_pattern;
+        pos = 0;
+        group_depth = 0;
+        Fragment fragment{};
+        const bool parsed = ParseAlternation(fragment) && !pattern[pos];
+        pattern = nullptr;
+        if (!parsed) return false;
+
+        const int accept = AddState(NfaType::Accept, -1, -1, -1);
+        if (accept < 0) return false;
+        Patch(fragment.outs, accept);
+
+        // Unanchored search: a loop over any byte in front of the expression
+        ByteSet any_byte;
+        FillMemory(any_byte.bits, sizeof(any_byte.bits), 0xFF);
+        if (!byte_sets.PushBack(any_byte)) return false;
+        const int any_state = AddState(NfaType::Byte, -1, -1, static_cast<int>(byte_sets.Size() - 1));
+        nfa_start = AddState(NfaType::Split, any_state, fragment.start, -1);
+        if (any_state < 0 || nfa_start < 0) return false;
+        nfa[any_state].out = nfa_start;
+
+        CopyMemory(required, fragment.literal.required, fragment.literal.required_size);
+        required_size = fragment.literal.required_size;
+        BuildByteClasses();
+
+        // The closure work area never grows while matching
+        const size_t nfa_size = nfa.Size();
+        if (!work_set.Resize(nfa_size) || !work_stack.Resize(3 * nfa_size + 1) || !marks.Resize(nfa_size))
+        {
+            print_last_error("Bad alloc");
+            return false;
+        }
+        work_set.Reset();
+        work_stack.Reset();
+        ZeroMemory(marks.Data(), nfa_size * sizeof(unsigned));
+        mark = 0;
+        is_ok = true;
+        return true;
+    }
+
+    bool CRegexp::IsOk() const
+    {
+        return is_ok;
+    }
+
+    bool CRegexp::Match(const char* test, size_t test_size) const
+    {
+        if (!IsOk() || !test) return false;
+        if (required_size && !FindLiteral(test, test_size, required, required_size)) return false;
+
+        int state = BeginStream();
+        return FeedStream(state, test, test_size) || EndStream(state);
+    }
+
+    int CRegexp::BeginStream() const
+    {
+        return IsOk() ? StartState() : -1;
+    }
+
+    bool CRegexp::FeedStream(int& state, const char* piece, size_t piece_size) const
+    {
+        if (state < 0) return false;
+        if (dfa[state].match) return true;
+
+        const auto* bytes = reinterpret_cast<const unsigned char*>(piece);
+        const int* table = transitions.Data();
+        for (size_t i{}; i < piece_size; ++i)
+        {
+            const int byte_class_index = byte_class[bytes[i]];
+            const int next = table[state * class_count + byte_class_index];
+            if (next > 0)
+            {
+                state = next - 1;
+                continue;
+            }
+            if (next == match_transition) return true;
+
+            state = NextState(state, byte_class_index);
+            if (state < 0) return false;
+            if (dfa[state].match) return true;
+            table = transitions.Data();
+        }
+        return false;
+    }
+
+    bool CRegexp::EndStream(int state) const
+    {
+        return state >= 0 && dfa[state].match_at_end;
+    }
+
+    bool CRegexp::ParseAlternation(Fragment& fragment)
+    {
+        if (!ParseConcatenation(fragment)) return false;
+        while (pattern[pos] == '|')
+        {
+            ++pos;
+            Fragment other{};
+            if (!ParseConcatenation(other) || !Alternate(fragment, other)) return false;
+        }
+        return true;
+    }
+
+    bool CRegexp::ParseConcatenation(Fragment& fragment)
+    {
+        bool is_empty = true;
+        while (pattern[pos] && pattern[pos] != '|' && pattern[pos] != ')')
+        {
+            Fragment next{};
+            if (!ParseRepetition(next)) return false;
+            if (is_empty)
+            {
+                fragment = next;
+                is_empty = false;
+            }
+            else if (!Concatenate(fragment, next)) return false;
+        }
+        return !is_empty || EmptyFragment(fragment);
+    }
+
+    bool CRegexp::ParseRepetition(Fragment& fragment)
+    {
+        const size_t atom_begin = pos;
+        if (!ParseAtom(fragment)) return false;
+
+        const char ch = pattern[pos];
+        if (ch == '*' || ch == '+' || ch == '?')
+        {
+            ++pos;
+            if (!(ch == '*' ? Star(fragment) : ch == '+' ? Plus(fragment) : Quest(fragment))) return false;
+        }
+        else if (ch == '{')
+        {
+            int min_count{};
+            int max_count{};
+            const size_t bounds_begin = pos;
+            if (!ParseBounds(min_count, max_count))
+            {
+                // Not a repetition, the brace is a literal
+                pos = bounds_begin;
+                return true;
+            }
+            if (min_count > max_repeat_count || max_count > max_repeat_count || (max_count >= 0 && min_count > max_count)) return false;
+            const size_t bounds_end = pos;
+
+            // Every copy but the first one is parsed again from the atom
+            bool is_parsed = true;
+            const auto next_copy = [&](Fragment& copy)
+            {
+                if (is_parsed)
+                {
+                    copy = fragment;
+                    is_parsed = false;
+                    return true;
+                }
+                pos = atom_begin;
+                return ParseAtom(copy);
+            };
+
+            Fragment result{};
+            if (!EmptyFragment(result)) return false;
+            for (int i{}; i < min_count; ++i)
+            {
+                Fragment copy{};
+                if (!next_copy(copy) || !Concatenate(result, copy)) return false;
+            }
+            if (max_count < 0)
+            {
+                Fragment copy{};
+                if (!next_copy(copy) || !Star(copy) || !Concatenate(result, copy)) return false;
+            }
+            for (int i = min_count; i < max_count; ++i)
+            {
+                Fragment copy{};
+                if (!next_copy(copy) || !Quest(copy) || !Concatenate(result, copy)) return false;
+            }
+            fragment = result;
+            pos = bounds_end;
+        }
+        else return true;
+
+        // The lazy forms match the same lines
+        if (pattern[pos] == '?') ++pos;
+        // A repetition of a repetition
+        return pattern[pos] != '*' && pattern[pos] != '+' && pattern[pos] != '?';
+    }
+
+    bool CRegexp::ParseAtom(Fragment& fragment)
+    {
+        ByteSet byte_set{};
+        const char ch = pattern[pos];
+        switch (ch)
+        {
+        case '(':
+            if (++group_depth > max_group_depth) return false;
+            ++pos;
+            if (pattern[pos] == '?' && pattern[pos + 1] == ':') pos += 2;
+            if (!ParseAlternation(fragment) || pattern[pos] != ')') return false;
+            ++pos;
+            --group_depth;
+            return true;
+        case '^':
+            ++pos;
+            return AnchorFragment(NfaType::LineBegin, fragment);
+        case '$':
+            ++pos;
+            return AnchorFragment(NfaType::LineEnd, fragment);
+        case '.':
+            ++pos;
+            FillMemory(byte_set.bits, sizeof(byte_set.bits), 0xFF);
+            return ByteFragment(byte_set, fragment);
+        case '[':
+            ++pos;
+            return ParseClass(byte_set) && ByteFragment(byte_set, fragment);
+        case '\\':
+            ++pos;
+            return ParseEscape(byte_set) && ByteFragment(byte_set, fragment);
+        case '*':
+        case '+':
+        case '?':
+            // Nothing to repeat
+            return false;
+        case '{':
+        {
+            int min_count{};
+            int max_count{};
+            if (ParseBounds(min_count, max_count)) return false;
+            break;
+        }
+        default:
+            break;
+        }
+        ++pos;
+        byte_set.Set(static_cast<unsigned char>(ch));
+        return ByteFragment(byte_set, fragment);
+    }
+
+    bool CRegexp::ParseBounds(int& min_count, int& max_count)
+    {
+        // {n} {n,} {n,m} {,m}
+        size_t i = pos + 1;
+        const auto parse_number = [&](int& number)
+        {
+            number = -1;
+            while (IsDigit(pattern[i]))
+            {
+                number = (number < 0 ? 0 : number) * 10 + (pattern[i++] - '0');
+                if (number > max_repeat_count) number = max_repeat_count + 1;
+            }
+            return number >= 0;
+        };
+
+        const bool has_min = parse_number(min_count);
+        if (pattern[i] == '}')
+        {
+            if (!has_min) return false;
+            max_count = min_count;
+        }
+        else if (pattern[i] == ',')
+        {
+            ++i;
+            const bool has_max = parse_number(max_count);
+            if (pattern[i] != '}' || (!has_min && !has_max)) return false;
+            if (!has_min) min_count = 0;
+        }
+        else return false;
+        pos = i + 1;
+        return true;
+    }
+
+    bool CRegexp::ParseClass(ByteSet& byte_set)
+    {
+        const bool negate = pattern[pos] == '^';
+        if (negate) ++pos;
+
+        // A bracket right after the opening one is a literal
+        for (bool first = true; first || pattern[pos] != ']'; first = false)
+        {
+            if (!pattern[pos]) return false;
+
+            ByteSet item{};
+            if (pattern[pos] == '\\')
+            {
+                ++pos;
+                if (!ParseEscape(item)) return false;
+            }
+            else
+            {
+                item.Set(static_cast<unsigned char>(pattern[pos++]));
+            }
+
+            int low = -1;
+            for (int i{}, count{}; i < 256; ++i)
+            {
+                if (item.Test(static_cast<unsigned char>(i)))
+                {
+                    low = ++count == 1 ? i : -1;
+                    if (count > 1) break;
+                }
+            }
+
+            if (low >= 0 && pattern[pos] == '-' && pattern[pos + 1] && pattern[pos + 1] != ']')
+            {
+                ++pos;
+                int high = static_cast<unsigned char>(pattern[pos]);
+                if (pattern[pos] == '\\')
+                {
+                    ++pos;
+                    ByteSet high_item{};
+                    if (!ParseEscape(high_item)) return false;
+                    high = -1;
+                    for (int i{}; i < 256 && high < 0; ++i)
+                    {
+                        if (high_item.Test(static_cast<unsigned char>(i))) high = i;
+                    }
+                }
+                else ++pos;
+                if (high < low) return false;
+                for (int i = low; i <= high; ++i)
+                {
+                    byte_set.Set(static_cast<unsigned char>(i));
+                }
+                continue;
+            }
+
+            for (size_t i{}; i < sizeof(byte_set.bits); ++i)
+            {
+                byte_set.bits[i] |= item.bits[i];
+            }
+        }
+        ++pos;
+
+        if (negate)
+        {
+            for (size_t i{}; i < sizeof(byte_set.bits); ++i)
+            {
+                byte_set.bits[i] = static_cast<unsigned char>(~byte_set.bits[i]);
+            }
+        }
+        return true;
+    }
+
+    bool CRegexp::ParseEscape(ByteSet& byte_set)
+    {
+        const char ch = pattern[pos];
+        if (!ch) return false;
+        ++pos;
+
+        switch (ch)
+        {
+        case 'd':
+        case 'D':
+            for (char i = '0'; i <= '9'; ++i) byte_set.Set(i);
+            break;
+        case 'w':
+        case 'W':
+            for (char i = '0'; i <= '9'; ++i) byte_set.Set(i);
+            for (char i = 'a'; i <= 'z'; ++i) byte_set.Set(i);
+            for (char i = 'A'; i <= 'Z'; ++i) byte_set.Set(i);
+            byte_set.Set('_');
+            break;
+        case 's':
+        case 'S':
+            for (const char* i = " \t\r\n\f\v"; *i; ++i) byte_set.Set(*i);
+            break;
+        case 't':
+            byte_set.Set('\t');
+            break;
+        case 'n':
+            byte_set.Set('\n');
+            break;
+        case 'r':
+            byte_set.Set('\r');
+            break;
+        case 'f':
+            byte_set.Set('\f');
+            break;
+        case 'v':
+            byte_set.Set('\v');
+            break;
+        case 'x':
+        {
+            const int high = HexValue(pattern[pos]);
+            const int low = high < 0 ? -1 : HexValue(pattern[pos + 1]);
+            if (low < 0) return false;
+            pos += 2;
+            byte_set.Set(static_cast<unsigned char>(high * 16 + low));
+            break;
+        }
+        default:
+            // Unknown letter escapes are reserved, anything else stands for itself
+            if ((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || IsDigit(ch)) return false;
+            byte_set.Set(static_cast<unsigned char>(ch));
+            break;
+        }
+
+        if (ch == 'D' || ch == 'W' || ch == 'S')
+        {
+            for (size_t i{}; i < sizeof(byte_set.bits); ++i)
+            {
+                byte_set.bits[i] = static_cast<unsigned char>(~byte_set.bits[i]);
+            }
+        }
+        return true;
+    }
+
+    bool CRegexp::ByteFragment(const ByteSet& byte_set, Fragment& fragment)
+    {
+        if (!byte_sets.PushBack(byte_set)) return false;
+        const int state = AddState(NfaType::Byte, -1, -1, static_cast<int>(byte_sets.Size() - 1));
+        if (state < 0) return false;
+        fragment.start = state;
+        fragment.outs = state * 2;
+        fragment.literal = {};
+
+        int single = -1;
+        for (int i{}, count{}; i < 256; ++i)
+        {
+            if (byte_set.Test(static_cast<unsigned char>(i)))
+            {
+                single = ++count == 1 ? i : -1;
+                if (count > 1) break;
+            }
+        }
+        if (single >= 0)
+        {
+            auto& literal = fragment.literal;
+            literal.prefix[0] = literal.suffix[0] = literal.required[0] = static_cast<char>(single);
+            literal.prefix_size = literal.suffix_size = literal.required_size = 1;
+            literal.is_exact = true;
+        }
+        return true;
+    }
+
+    bool CRegexp::AnchorFragment(NfaType type, Fragment& fragment)
+    {
+        if (!EmptyFragment(fragment)) return false;
+        nfa[fragment.start].type = type;
+        return true;
+    }
+
+    int CRegexp::AddState(NfaType type, int out, int out1, int byte_set)
+    {
+        if (nfa.Size() >= max_nfa_states) return -1;
+        const NfaState state{ type, out, out1, byte_set };
+        if (!nfa.PushBack(state)) return -1;
+        return static_cast<int>(nfa.Size() - 1);
+    }
+
+    int& CRegexp::Out(int out_ref)
+    {
+        return out_ref & 1 ? nfa[out_ref >> 1].out1 : nfa[out_ref >> 1].out;
+    }
+
+    int CRegexp::AppendOuts(int outs, int other_outs)
+    {
+        if (outs < 0) return other_outs;
+        int last = outs;
+        while (Out(last) >= 0)
+        {
+            last = Out(last);
+        }
+        Out(last) = other_outs;
+        return outs;
+    }
+
+    void CRegexp::Patch(int outs, int state)
+    {
+        while (outs >= 0)
+        {
+            int& out = Out(outs);
+            outs = out;
+            out = state;
+        }
+    }
+
+    bool CRegexp::EmptyFragment(Fragment& fragment)
+    {
+        const int state = AddState(NfaType::Empty, -1, -1, -1);
+        if (state < 0) return false;
+        fragment.start = state;
+        fragment.outs = state * 2;
+        fragment.literal = {};
+        fragment.literal.is_exact = true;
+        return true;
+    }
+
+    bool CRegexp::Concatenate(Fragment& fragment, const Fragment& next)
+    {
+        Patch(fragment.outs, next.start);
+        fragment.outs = next.outs;
+        ConcatenateLiterals(fragment.literal, next.literal);
+        return true;
+    }
+
+    bool CRegexp::Alternate(Fragment& fragment, const Fragment& other)
+    {
+        const int state = AddState(NfaType::Split, fragment.start, other.start, -1);
+        if (state < 0) return false;
+        fragment.start = state;
+        fragment.outs = AppendOuts(fragment.outs, other.outs);
+        AlternateLiterals(fragment.literal, other.literal);
+        return true;
+    }
+
+    bool CRegexp::Star(Fragment& fragment)
+    {
+        const int state = AddState(NfaType::Split, fragment.start, -1, -1);
+        if (state < 0) return false;
+        Patch(fragment.outs, state);
+        fragment.start = state;
+        fragment.outs = state * 2 + 1;
+        fragment.literal = {};
+        return true;
+    }
+
+    bool CRegexp::Plus(Fragment& fragment)
+    {
+        const int state = AddState(NfaType::Split, fragment.start, -1, -1);
+        if (state < 0) return false;
+        Patch(fragment.outs, state);
+        fragment.outs = state * 2 + 1;
+        fragment.literal.is_exact = false;
+        return true;
+    }
+
+    bool CRegexp::Quest(Fragment& fragment)
+    {
+        const int state = AddState(NfaType::Split, fragment.start, -1, -1);
+        if (state < 0) return false;
+        fragment.start = state;
+        fragment.outs = AppendOuts(fragment.outs, state * 2 + 1);
+        fragment.literal = {};
+        return true;
+    }
+
+    void CRegexp::ConcatenateLiterals(Literal& literal, const Literal& next)
+    {
+        // The suffix and the next prefix are adjacent in every match
+        char joined[2 * max_literal_size];
+        const size_t joined_size = literal.suffix_size + next.prefix_size;
+        CopyMemory(joined, literal.suffix, literal.suffix_size);
+        CopyMemory(joined + literal.suffix_size, next.prefix, next.prefix_size);
+
+        Literal result{};
+        result.is_exact = literal.is_exact && next.is_exact && joined_size <= max_literal_size;
+        if (literal.is_exact)
+            CopyLiteral(result.prefix, result.prefix_size, joined, joined_size, max_literal_size);
+        else
+            CopyLiteral(result.prefix, result.prefix_size, literal.prefix, literal.prefix_size, max_literal_size);
+        if (next.is_exact)
+        {
+            const size_t suffix_size = min(joined_size, max_literal_size);
+            CopyLiteral(result.suffix, result.suffix_size, joined + joined_size - suffix_size, suffix_size, max_literal_size);
+        }
+        else
+            CopyLiteral(result.suffix, result.suffix_size, next.suffix, next.suffix_size, max_literal_size);
+
+        CopyLiteral(result.required, result.required_size, literal.required, literal.required_size, max_literal_size);
+        KeepLonger(result.required, result.required_size, next.required, next.required_size, max_literal_size);
+        KeepLonger(result.required, result.required_size, joined, joined_size, max_literal_size);
+        literal = result;
+    }
+
+    void CRegexp::AlternateLiterals(Literal& literal, const Literal& other)
+    {
+        Literal result{};
+        while (result.prefix_size < min(literal.prefix_size, other.prefix_size)
+            && literal.prefix[result.prefix_size] == other.prefix[result.prefix_size])
+        {
+            result.prefix[result.prefix_size] = literal.prefix[result.prefix_size];
+            ++result.prefix_size;
+        }
+        while (result.suffix_size < min(literal.suffix_size, other.suffix_size)
+            && literal.suffix[literal.suffix_size - result.suffix_size - 1] == other.suffix[other.suffix_size - result.suffix_size - 1])
+        {
+            ++result.suffix_size;
+        }
+        CopyMemory(result.suffix, literal.suffix + literal.suffix_size - result.suffix_size, result.suffix_size);
+
+        result.is_exact = literal.is_exact && other.is_exact && literal.prefix_size == other.prefix_size
+            && !memcmp(literal.prefix, other.prefix, literal.prefix_size);
+        if (literal.required_size == other.required_size && !memcmp(literal.required, other.required, literal.required_size))
+            CopyLiteral(result.required, result.required_size, literal.required, literal.required_size, max_literal_size);
+        KeepLonger(result.required, result.required_size, result.prefix, result.prefix_size, max_literal_size);
+        KeepLonger(result.required, result.required_size, result.suffix, result.suffix_size, max_literal_size);
+        literal = result;
+    }
+
+    void CRegexp::BuildByteClasses()
+    {
+        // Splits the classes by every byte set, the bytes of a class go to the same states
+        ZeroMemory(byte_class, sizeof(byte_class));
+        class_count = 1;
+        for (size_t i{}; i < byte_sets.Size(); ++i)
+        {
+            int remap[512];
+            FillMemory(remap, sizeof(remap), 0xFF);
+            int new_count{};
+            for (int ch{}; ch < 256; ++ch)
+            {
+                const int key = byte_class[ch] * 2 + (byte_sets[i].Test(static_cast<unsigned char>(ch)) ? 1 : 0);
+                if (remap[key] < 0) remap[key] = new_count++;
+                byte_class[ch] = static_cast<unsigned char>(remap[key]);
+            }
+            class_count = new_count;
+        }
+        for (int ch{}; ch < 256; ++ch)
+        {
+            class_byte[byte_class[ch]] = static_cast<unsigned char>(ch);
+        }
+    }
+
+    void CRegexp::NextMark() const
+    {
+        if (!++mark)
+        {
+            ZeroMemory(marks.Data(), marks.Size() * sizeof(unsigned));
+            mark = 1;
+        }
+    }
+
+    void CRegexp::AddClosure(int nfa_state, bool at_begin) const
+    {
+        work_stack.Reset();
+        work_stack.PushBack(nfa_state);
+        while (!work_stack.IsEmpty())
+        {
+            const int state = work_stack[work_stack.Size() - 1];
+            work_stack.Resize(work_stack.Size() - 1);
+            if (state < 0 || marks[state] == mark) continue;
+            marks[state] = mark;
+
+            const auto& nfa_state_ref = nfa[state];
+            switch (nfa_state_ref.type)
+            {
+            case NfaType::Split:
+                work_stack.PushBack(nfa_state_ref.out1);
+                work_stack.PushBack(nfa_state_ref.out);
+                break;
+            case NfaType::Empty:
+                work_stack.PushBack(nfa_state_ref.out);
+                break;
+            case NfaType::LineBegin:
+                if (at_begin) work_stack.PushBack(nfa_state_ref.out);
+                break;
+            default:
+                // Byte and Accept, the line end is followed only at the end of the line
+                work_set.PushBack(state);
+                break;
+            }
+        }
+    }
+
+    bool CRegexp::EndMatches(const int* nfa_set, size_t nfa_set_size, bool at_begin) const
+    {
+        NextMark();
+        work_stack.Reset();
+        for (size_t i{}; i < nfa_set_size; ++i)
+        {
+            if (nfa[nfa_set[i]].type == NfaType::LineEnd) work_stack.PushBack(nfa[nfa_set[i]].out);
+        }
+        while (!work_stack.IsEmpty())
+        {
+            const int state = work_stack[work_stack.Size() - 1];
+            work_stack.Resize(work_stack.Size() - 1);
+            if (state < 0 || marks[state] == mark) continue;
+            marks[state] = mark;
+
+            const auto& nfa_state_ref = nfa[state];
+            switch (nfa_state_ref.type)
+            {
+            case NfaType::Accept:
+                return true;
+            case NfaType::Split:
+                work_stack.PushBack(nfa_state_ref.out1);
+                work_stack.PushBack(nfa_state_ref.out);
+                break;
+            case NfaType::LineBegin:
+                if (at_begin) work_stack.PushBack(nfa_state_ref.out);
+                break;
+            case NfaType::Empty:
+            case NfaType::LineEnd:
+                work_stack.PushBack(nfa_state_ref.out);
+                break;
+            default:
+                break;
+            }
+        }
+        return false;
+    }
+
+    int CRegexp::StartState() const
+    {
+        if (start_state < 0)
+        {
+            NextMark();
+            work_set.Reset();
+            AddClosure(nfa_start, true);
+            start_state = FindOrAddState(true);
+        }
+        return start_state;
+    }
+
+    int CRegexp::NextState(int dfa_state, int byte_class_index) const
+    {
+        const auto ch = class_byte[byte_class_index];
+        const auto state = dfa[dfa_state];
+        NextMark();
+        work_set.Reset();
+        for (int i{}; i < state.nfa_size; ++i)
+        {
+            const auto& nfa_state_ref = nfa[nfa_sets[state.nfa_begin + i]];
+            if (nfa_state_ref.type == NfaType::Byte && byte_sets[nfa_state_ref.byte_set].Test(ch))
+            {
+                AddClosure(nfa_state_ref.out, false);
+            }
+        }
+
+        const auto generation = cache_generation;
+        const int next = FindOrAddState(false);
+        // After a flush the source state is gone, the matching goes on from the new one
+        if (next >= 0 && generation == cache_generation)
+        {
+            transitions[dfa_state * class_count + byte_class_index] = dfa[next].match ? match_transition : next + 1;
+        }
+        return next;
+    }
+
+    int CRegexp::FindOrAddState(bool at_begin) const
+    {
+        if (dfa_index.IsEmpty() && !RebuildIndex(initial_index_size))
+        {
+            print_last_error("Bad alloc");
+            return -1;
+        }
+
+        qsort(work_set.Data(), work_set.Size(), sizeof(int), CompareStates);
+        const int* set = work_set.Data();
+        const size_t set_size = work_set.Size();
+        const size_t index_mask = dfa_index.Size() - 1;
+
+        for (size_t i = HashStates(set, set_size, at_begin) & index_mask;; i = (i + 1) & index_mask)
+        {
+            const int index = dfa_index[i];
+            if (!index) break;
+            const auto& state = dfa[index - 1];
+            if (state.at_begin == at_begin && static_cast<size_t>(state.nfa_size) == set_size
+                && !memcmp(nfa_sets.Data() + state.nfa_begin, set, set_size * sizeof(int)))
+            {
+                return index - 1;
+            }
+        }
+
+        if (transitions.Size() + nfa_sets.Size() + class_count + set_size > max_dfa_cache_size)
+        {
+            FlushCache();
+        }
+        const size_t index_size = dfa_index.IsEmpty() ? initial_index_size : 2 * dfa_index.Size();
+        if (2 * (dfa.Size() + 1) > dfa_index.Size() && !RebuildIndex(index_size))
+        {
+            print_last_error("Bad alloc");
+            return -1;
+        }
+
+        DfaState state{};
+        state.nfa_begin = static_cast<int>(nfa_sets.Size());
+        state.nfa_size = static_cast<int>(set_size);
+        state.at_begin = at_begin;
+        for (size_t i{}; i < set_size && !state.match; ++i)
+        {
+            state.match = nfa[set[i]].type == NfaType::Accept;
+        }
+        state.match_at_end = state.match || EndMatches(set, set_size, at_begin);
+
+        if (!nfa_sets.Resize(nfa_sets.Size() + set_size)
+            || !transitions.Resize(transitions.Size() + class_count)
+            || !dfa.PushBack(state))
+        {
+            print_last_error("Bad alloc");
+            FlushCache();
+            return -1;
+        }
+        CopyMemory(nfa_sets.Data() + state.nfa_begin, set, set_size * sizeof(int));
+
+        const int index = static_cast<int>(dfa.Size() - 1);
+        const size_t new_index_mask = dfa_index.Size() - 1;
+        size_t i = HashStates(set, set_size, at_begin) & new_index_mask;
+        while (dfa_index[i])
+        {
+            i = (i + 1) & new_index_mask;
+        }
+        dfa_index[i] = index + 1;
+        return index;
+    }
+
+    bool CRegexp::RebuildIndex(size_t index_size) const
+    {
+        dfa_index.Reset();
+        if (!dfa_index.Resize(index_size)) return false;
+        for (size_t state_index{}; state_index < dfa.Size(); ++state_index)
+        {
+            const auto& state = dfa[state_index];
+            size_t i = HashStates(nfa_sets.Data() + state.nfa_begin, state.nfa_size, state.at_begin) & (index_size - 1);
+            while (dfa_index[i])
+            {
+                i = (i + 1) & (index_size - 1);
+            }
+            dfa_index[i] = static_cast<int>(state_index + 1);
+        }
+        return true;
+    }
+
+    void CRegexp::FlushCache() const
+    {
+        dfa.Reset();
+        transitions.Reset();
+        nfa_sets.Reset();
+        dfa_index.Reset();
+        start_state = -1;
+        ++cache_generation;
+    }
+}
@@ -0,0 +1,180 @@
+#pragma once
+#include "Utilities.h"
+
+/************************************************************************************************************************************************************
+/* Method of Implementation
+/* The expression is compiled by recursive descent into a Thompson NFA, a bounded repetition is compiled by parsing its atom once for every copy.
+/* An unanchored search is the NFA with a loop over any byte in front of it.
+/* The NFA is run as a DFA whose states are the sets of NFA states, they are built lazily: a transition is computed the first time it is taken.
+/* Bytes which no part of the expression distinguishes share one column of the transition table.
+/* The DFA states live in a cache of bounded size, when it is full it is flushed and the matching continues from the current state,
+/* so a byte never costs more than one step of the NFA and there is no backtracking.
+/* A literal that every match must contain is derived from the expression and searched before running the DFA.
+/* The state of the DFA is all there is to keep between the pieces of a line, so a line of any size can be searched piece by piece.
+/*
+/* Syntax: literals, ., [...] and [^...] with ranges, \d \w \s \D \W \S \t \n \r \f \v \xHH and escaped metacharacters,
+/* ( ) and (?: ), |, * + ? {n} {n,} {n,m} (the lazy forms are accepted), ^ and $ at the line boundaries.
+/************************************************************************************************************************************************************/
+namespace log_test
+{
+    class CRegexp final
+    {
+        CRegexp(CRegexp&) = delete;
+        CRegexp(CRegexp&&) = delete;
+
+        CRegexp& operator=(CRegexp&) = delete;
+        CRegexp& operator=(CRegexp&&) = delete;
+
+    public:
+        CRegexp() = default;
+
+        // Compiles the expression, false if it is not valid or its groups are nested too deeply
+        bool Compile(const char* pattern);
+
+        // Flag that the expression is compiled
+        bool IsOk() const;
+
+        // Searches the expression in the line
+        bool Match(const char* test, size_t test_size) const;
+
+        // Searching in a line which comes in pieces, the caller keeps the state between the pieces:
+        // BeginStream returns the initial state, FeedStream returns true as soon as the expression is found,
+        // EndStream tells whether it is found at the end of the line. A negative state is an error.
+        int BeginStream() const;
+        bool FeedStream(int& state, const char* piece, size_t piece_size) const;
+        bool EndStream(int state) const;
+
+    private:
+        static constexpr size_t max_literal_size = 32;
+        static constexpr size_t max_nfa_states = 0x8000;
+        // Transitions and NFA state sets in the DFA cache, in ints
+        static constexpr size_t max_dfa_cache_size = 0x80000;
+
+        enum class NfaType : unsigned char
+        {
+            Byte,
+            Split,
+            Empty,
+            LineBegin,
+            LineEnd,
+            Accept
+        };
+
+        struct NfaState
+        {
+            NfaType type;
+            // The next states, dangling outs are linked in a list through these fields while compiling
+            int out;
+            int out1;
+            // Index of the byte set for the Byte state
+            int byte_set;
+        };
+
+        struct ByteSet
+        {
+            unsigned char bits[32];
+            bool Test(unsigned char ch) const { return (bits[ch >> 3] >> (ch & 7)) & 1; }
+            void Set(unsigned char ch) { bits[ch >> 3] |= 1 << (ch & 7); }
+        };
+
+        // Literals of a fragment: every match starts with the prefix, ends with the suffix and contains the required one,
+        // if the fragment is exact the prefix is the only string it matches
+        struct Literal
+        {
+            char prefix[max_literal_size];
+            size_t prefix_size;
+            char suffix[max_literal_size];
+            size_t suffix_size;
+            char required[max_literal_size];
+            size_t required_size;
+            bool is_exact;
+        };
+        static void ConcatenateLiterals(Literal& literal, const Literal& next);
+        static void AlternateLiterals(Literal& literal, const Literal& other);
+
+        // A part of the NFA with the list of its dangling outs
+        struct Fragment
+        {
+            int start;
+            int outs;
+            Literal literal;
+        };
+
+        struct DfaState
+        {
+            int nfa_begin;
+            int nfa_size;
+            bool at_begin;
+            bool match;
+            bool match_at_end;
+        };
+
+        // Transitions hold the index of the next state plus one
+        static constexpr int unknown_transition = 0;
+        static constexpr int match_transition = -1;
+
+        // Parsing, pos is the current position in the pattern
+        bool ParseAlternation(Fragment& fragment);
+        bool ParseConcatenation(Fragment& fragment);
+        bool ParseRepetition(Fragment& fragment);
+        bool ParseAtom(Fragment& fragment);
+        bool ParseBounds(int& min_count, int& max_count);
+        bool ParseClass(ByteSet& byte_set);
+        bool ParseEscape(ByteSet& byte_set);
+        bool ByteFragment(const ByteSet& byte_set, Fragment& fragment);
+        bool AnchorFragment(NfaType type, Fragment& fragment);
+
+        // Thompson construction
+        int AddState(NfaType type, int out, int out1, int byte_set);
+        int& Out(int out_ref);
+        int AppendOuts(int outs, int other_outs);
+        void Patch(int outs, int state);
+        bool EmptyFragment(Fragment& fragment);
+        bool Concatenate(Fragment& fragment, const Fragment& next);
+        bool Alternate(Fragment& fragment, const Fragment& other);
+        bool Star(Fragment& fragment);
+        bool Plus(Fragment& fragment);
+        bool Quest(Fragment& fragment);
+
+        void BuildByteClasses();
+
+        // Lazy DFA
+        void NextMark() const;
+        void AddClosure(int nfa_state, bool at_begin) const;
+        bool EndMatches(const int* nfa_set, size_t nfa_set_size, bool at_begin) const;
+        int StartState() const;
+        int NextState(int dfa_state, int byte_class) const;
+        int FindOrAddState(bool at_begin) const;
+        bool RebuildIndex(size_t index_size) const;
+        void FlushCache() const;
+
+    private:
+        const char* pattern{};
+        size_t pos{};
+        // Nesting of the group being parsed
+        size_t group_depth{};
+        bool is_ok{};
+
+        SimpleArray<NfaState> nfa;
+        SimpleArray<ByteSet> byte_sets;
+        int nfa_start{};
+        char required[max_literal_size];
+        size_t required_size{};
+
+        unsigned char byte_class[256];
+        int class_count{};
+        unsigned char class_byte[256];
+
+        mutable SimpleArray<DfaState> dfa;
+        mutable SimpleArray<int> transitions;
+        mutable SimpleArray<int> nfa_sets;
+        mutable SimpleArray<int> dfa_index;
+        mutable int start_state{};
+        mutable size_t cache_generation{};
+        // Closure work area: the set being built and the marks of the states already in it
+        mutable SimpleArray<int> work_set;
+        mutable SimpleArray<int> work_stack;
+        mutable SimpleArray<unsigned> marks;
+        mutable unsigned mark{};
+    };
+}
@@ -1,31 +1,67 @@
 #include "SimpleRegexp.h"
+#include "Regexp.h"
+#include "Kernels.h"
 #include <windows.h>
 
 namespace log_test
 {
-	CSimpleRegexp::CSimpleRegexp(const char* filter)
+	namespace
 	{
-		SetFilter(filter);
+		// Leaves the last keep_size bytes of the buffer followed by the piece, the buffer has room for them
+		void KeepLast(SimpleArray<char>& buffer, size_t keep_size, const char* piece, size_t size)
+		{
+			if (!keep_size)
+				return;
+			if (size >= keep_size)
+			{
+				buffer.Resize(keep_size);
+				CopyMemory(buffer.Data(), piece + size - keep_size, keep_size);
+				return;
+			}
+			const size_t old_size = min(buffer.Size(), keep_size - size);
+			MoveMemory(buffer.Data(), buffer.Data() + buffer.Size() - old_size, old_size);
+			buffer.Resize(old_size + size);
+			CopyMemory(buffer.Data() + old_size, piece, size);
+		}
+	}
+
+	CSimpleRegexp::CSimpleRegexp(const char* filter, FilterSyntax filter_syntax)
+	{
+		SetFilter(filter, filter_syntax);
 	}
 
 	CSimpleRegexp::~CSimpleRegexp()
 	{
-		if (lookup_table)
-			HeapFree(GetProcessHeap(), 0, lookup_table);
+		delete regexp;
 	}
-	bool* lookup_table{};
-	size_t lookup_size{};
 
-	bool CSimpleRegexp::SetFilter(const char* new_filter)
+	bool CSimpleRegexp::SetFilter(const char* new_filter, FilterSyntax filter_syntax)
 	{
 		filter.Reset();
+		syntax = filter_syntax;
+		// The expression set before does not survive a failed call
+		if (regexp)
+			regexp->Compile(nullptr);
 		if (!new_filter) return false;
+		if (syntax == FilterSyntax::Regexp)
+		{
+			if (!regexp)
+				regexp = new CRegexp;
+			return regexp->Compile(new_filter);
+		}
 		Simplify(new_filter);
+		if (!Split())
+		{
+			filter.Reset();
+			return false;
+		}
 		return IsOk();
 	}
 
 	bool CSimpleRegexp::IsOk() const
 	{
+		if (syntax == FilterSyntax::Regexp)
+			return regexp && regexp->IsOk();
 		return !filter.IsEmpty();
 	}
 
@@ -51,59 +87,222 @@ namespace log_test
 		}
 	}
 
-	void CSimpleRegexp::ResizeLookupBuffer(size_t new_lookup_size) const
+	bool CSimpleRegexp::Split()
 	{
-		if (new_lookup_size > lookup_size)
+		segments.Reset();
+		fixed_size = 0;
+		const auto* pattern = filter.Data();
+		const size_t pattern_len = filter.Size();
+		Segment segment{};
+		// The beginning of the current run without '?'
+		size_t run_begin{};
+		for (size_t i{}; i <= pattern_len; ++i)
 		{
-			lookup_table = static_cast<bool*>(
-				!lookup_size
-				? HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, new_lookup_size)
-				: HeapReAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, lookup_table, new_lookup_size)
-				);
-			lookup_size = new_lookup_size;
+			if (i < pattern_len && pattern[i] != '*')
+			{
+				if (pattern[i] == '?')
+					run_begin = i + 1;
+				else if (i + 1 - run_begin > segment.anchor_size)
+				{
+					segment.anchor_begin = run_begin - segment.begin;
+					segment.anchor_size = i + 1 - run_begin;
+				}
+				++segment.size;
+				continue;
+			}
+			if (!segments.PushBack(segment))
+				return false;
+			fixed_size += segment.size;
+			segment = {};
+			segment.begin = run_begin = i + 1;
+		}
+
+		// Room for the streaming state, so that it is never reallocated while matching
+		size_t max_middle_size{};
+		for (size_t i = 1; i + 1 < segments.Size(); ++i)
+			max_middle_size = max(max_middle_size, segments[i].size);
+		if (!stream_carry.Resize(max_middle_size) || !stream_join.Resize(2 * max_middle_size)
+			|| !stream_tail.Resize(segments[segments.Size() - 1].size))
+			return false;
+		return true;
+	}
+
+	const char* CSimpleRegexp::FindSegment(const char* text, size_t size, const Segment& segment) const
+	{
+		const auto* pattern = filter.Data() + segment.begin;
+		if (!segment.anchor_size)
+			return size >= segment.size ? text : nullptr;
+
+		for (size_t start{}; start + segment.size <= size;)
+		{
+			const auto* anchor = FindLiteral(text + start + segment.anchor_begin, size - start - segment.size + segment.anchor_size,
+				pattern + segment.anchor_begin, segment.anchor_size);
+			if (!anchor)
+				return nullptr;
+			const auto* candidate = anchor - segment.anchor_begin;
+			if (EqualMasked(candidate, pattern, segment.size, '?'))
+				return candidate;
+			start = candidate - text + 1;
 		}
+		return nullptr;
 	}
 
 	bool CSimpleRegexp::Match(const char* test)const
 	{
-		if (!IsOk() && !test) return false;
+		if (!IsOk() || !test) return false;
+		if (syntax == FilterSyntax::Regexp)
+			return regexp->Match(test, strlen(test));
 		const size_t test_len = strlen(test);
-		const size_t pattern_len = filter.Size();
 		const auto* pattern = filter.Data();
-		const size_t new_lookup_size = (test_len + 1) * (pattern_len + 1);
-		ResizeLookupBuffer(new_lookup_size);
-	
-		ZeroMemory(lookup_table, new_lookup_size);
-		lookup_table[0] = true;
+		const auto& first = segments[0];
+		if (segments.Size() == 1)
+			return test_len == first.size && EqualMasked(test, pattern, test_len, '?');
 
-		const auto lookup = [column_count = pattern_len + 1, this](size_t row, size_t column)->bool&
+		const auto& last = segments[segments.Size() - 1];
+		if (test_len < fixed_size) return false;
+		if (!EqualMasked(test, pattern + first.begin, first.size, '?')) return false;
+		if (!EqualMasked(test + test_len - last.size, pattern + last.begin, last.size, '?')) return false;
+
+		size_t pos = first.size;
+		const size_t end = test_len - last.size;
+		for (size_t i = 1; i + 1 < segments.Size(); ++i)
 		{
-			return lookup_table[row * column_count + column];
-		};
+			const auto* found = FindSegment(test + pos, end - pos, segments[i]);
+			if (!found) return false;
+			pos = found - test + segments[i].size;
+		}
+		return true;
+	}
 
-		for (size_t j = 1; j <= pattern_len; ++j)
+	bool CSimpleRegexp::MatchPiece(const char* piece, size_t size, bool is_line_begin, bool is_line_end) const
+	{
+		if (is_line_begin && is_line_end)
+			return Match(piece);
+		if (!IsOk() || !piece) return false;
+		if (is_line_begin)
+			BeginLine();
+		FeedLine(piece, size);
+		return is_line_end && EndLine();
+	}
+
+	void CSimpleRegexp::BeginLine() const
+	{
+		stream_size = 0;
+		stream_done = false;
+		stream_result = false;
+		if (syntax == FilterSyntax::Regexp)
+		{
+			stream_state = regexp->BeginStream();
+			return;
+		}
+		stream_segment = 1;
+		stream_found_end = segments[0].size;
+		stream_carry.Reset();
+		stream_tail.Reset();
+	}
+
+	void CSimpleRegexp::FeedLine(const char* piece, size_t size) const
+	{
+		if (stream_done) return;
+		if (syntax == FilterSyntax::Regexp)
+		{
+			stream_result = regexp->FeedStream(stream_state, piece, size);
+			stream_done = stream_result || stream_state < 0;
+			return;
+		}
+
+		const auto* pattern = filter.Data();
+		const auto& first = segments[0];
+		if (segments.Size() > 1)
+			KeepLast(stream_tail, segments[segments.Size() - 1].size, piece, size);
+
+		// The line should start with seg0
+		if (stream_size < first.size)
 		{
-			if (pattern[j - 1] == '*')
-				lookup(0, j) = lookup(0, j - 1);
+			const auto part = static_cast<size_t>(min(static_cast<unsigned long long>(size), first.size - stream_size));
+			if (!EqualMasked(piece, pattern + first.begin + stream_size, part, '?'))
+			{
+				stream_done = true;
+				return;
+			}
+			piece += part;
+			size -= part;
+			stream_size += part;
+		}
+		if (segments.Size() == 1)
+		{
+			// Longer than the wildcard
+			stream_done = size != 0;
+			return;
 		}
 
-		for (size_t i = 1; i <= test_len; i++)
+		// The middle segments are searched leftmost, one after another
+		while (size && stream_segment + 1 < segments.Size())
 		{
-			for (size_t j = 1; j <= pattern_len; j++)
+			const auto& segment = segments[stream_segment];
+			const size_t overlap = segment.size - 1;
+			const char* found_end{};
+			if (!stream_carry.IsEmpty())
 			{
-				if (pattern[j - 1] == '*')
+				// An occurrence which starts in the previous pieces
+				const size_t carry_size = stream_carry.Size();
+				const size_t head = min(size, overlap);
+				CopyMemory(stream_join.Data(), stream_carry.Data(), carry_size);
+				CopyMemory(stream_join.Data() + carry_size, piece, head);
+				const auto* found = FindSegment(stream_join.Data(), carry_size + head, segment);
+				if (found)
 				{
-					lookup(i, j) = lookup(i, j - 1) || lookup(i - 1, j);
+					found_end = piece + (found - stream_join.Data()) + segment.size - carry_size;
 				}
-				else if (pattern[j - 1] == '?' || test[i - 1] == pattern[j - 1])
+				else if (size < overlap)
+				{
+					KeepLast(stream_carry, overlap, piece, size);
+					stream_size += size;
+					return;
+				}
+				stream_carry.Reset();
+			}
+			if (!found_end)
+			{
+				const auto* found = FindSegment(piece, size, segment);
+				if (!found)
 				{
-					lookup(i, j) = lookup(i - 1, j - 1);
+					KeepLast(stream_carry, overlap, piece, size);
+					stream_size += size;
+					return;
 				}
-				else
-					lookup(i, j) = false;
+				found_end = found + segment.size;
 			}
+
+			const auto consumed = static_cast<size_t>(found_end - piece);
+			piece += consumed;
+			size -= consumed;
+			stream_size += consumed;
+			stream_found_end = stream_size;
+			++stream_segment;
+			stream_carry.Reset();
 		}
-		return lookup(test_len, pattern_len);
+		stream_size += size;
+	}
+
+	bool CSimpleRegexp::EndLine() const
+	{
+		if (stream_done)
+			return stream_result;
+		if (syntax == FilterSyntax::Regexp)
+			return regexp->EndStream(stream_state);
+
+		const auto& first = segments[0];
+		if (segments.Size() == 1)
+			return stream_size == first.size;
+		if (stream_size < first.size || stream_segment + 1 < segments.Size())
+			return false;
+
+		// segN should follow the last middle segment
+		const auto& last = segments[segments.Size() - 1];
+		if (stream_size - stream_found_end < last.size)
+			return false;
+		return EqualMasked(stream_tail.Data() + stream_tail.Size() - last.size, filter.Data() + last.begin, last.size, '?');
 	}
 	
 }
@@ -3,48 +3,85 @@
 
 /************************************************************************************************************************************************************ 
 /* Method of Implementation
-/* We will solve the problem by applying the following approach:
-/* Step 1: If the current character of the pattern is * and if it matches with the present character of the string we can just move one step forward in string.
-/* Step 2: If the * does not matches then we can just ignore it and move forward in the pattern by one step.
-/* Step 3: If the current character of the pattern is '?' then we move forward in both pattern and string.
-/* Step 4: If the current character of the pattern is not a wildcard character then it should positively match with the current character of the string.
-/* Step 5: If we have reached the end of both string and pattern then we return true.
-/* Step 6: If still string is left to be traversed and we have already reached the end of pattern then return false.
-/* Step 7: If we have reached the end of string but the pattern is still left to be traversed then we will return true /* only if the rest of the characters in the pattern are only *.
-/* 
-/* Pseudocode
-/* Step 1: Create a boolean 2-D matrix mat[m+1][n+1] where m is the length of the string and n is the length of the pattern.
-/* Step 2: Initialize mat[0][0]=1(because empty string and empty pattern always match.
-/* Step 3: Initialize mat[i][0]=0, because pattern will be empty.
-/* Step 4: Update the value of mat[0][i]=mat[0][i-1] if the current pat[i-1] = *.
-/* Step 5: Now start the comparison. If the current character of pattern is * then the value of mat[i][j]=mat[i-1][j]||mat[i][j-1].
-/* Step 6: If the current character of pattern is '?', then both the current characters of pattern and string should match, therefore mat[i][j]= mat[i-1][j-1].
-/* Step 7: If the current character of pattern is not wildcard character and if both the characters of pattern and string matches then mat[i][j]=mat[i-1][j-1]. Else if they don't match mat[i][j]=0.
+/* The wildcard is matched against the whole line. After collapsing consecutive asterisks the wildcard is split by * into segments seg0*seg1*...*segN,
+/* a segment holds literal characters and '?' which matches any one character.
+/* Step 1: If there is no *, the line should have the size of the wildcard and match it character by character.
+/* Step 2: The line should start with seg0 and end with segN, and these two should not overlap.
+/* Step 3: Every middle segment is searched from where the previous one ended, the leftmost occurrence is taken:
+/*         any later occurrence leaves less room for the segments that follow, so it cannot produce a match the leftmost one misses.
+/* Step 4: If all the middle segments are found before segN, the line matches.
+/*
+/* A segment is searched by its longest run without '?' (the anchor) and verified at every position where the anchor is found.
+/* The searches and the comparisons are done by the kernels of Kernels.h, so the line is scanned in vectors rather than byte by byte,
+/* and no table of the line size by the wildcard size is built.
+/*
+/* A line which comes in pieces is matched by the same steps as a state machine: seg0 is compared while the first bytes come,
+/* a middle segment which may cross the border of two pieces is searched in the bytes left from the previous piece joined with
+/* the beginning of the next one, and the last bytes of the line are kept for segN. The state never exceeds a few wildcard sizes.
 /************************************************************************************************************************************************************/
 namespace log_test
 {
 	// Implementing string - to - pattern matching
 	class CSimpleRegexp
 	{
+		// The parts of the wildcard between asterisks
+		struct Segment
+		{
+			size_t begin;
+			size_t size;
+			// The longest run without '?', relative to the segment begin
+			size_t anchor_begin;
+			size_t anchor_size;
+		};
+
 		SimpleString filter;
-		mutable bool* lookup_table{};
-		mutable size_t lookup_size{};
+		SimpleArray<Segment> segments;
+		// Size of the wildcard without asterisks, the shortest line it can match
+		size_t fixed_size{};
+		FilterSyntax syntax{};
+		// The compiled filter in the Regexp syntax
+		class CRegexp* regexp{};
+
+		// The state of matching a line which comes in pieces
+		mutable unsigned long long stream_size{};
+		// The next middle segment to find and where the last found one ends
+		mutable size_t stream_segment{};
+		mutable unsigned long long stream_found_end{};
+		// The outcome is known before the end of the line
+		mutable bool stream_done{};
+		mutable bool stream_result{};
+		// The last bytes of the previous pieces where the next middle segment may start
+		mutable SimpleArray<char> stream_carry;
+		mutable SimpleArray<char> stream_join;
+		// The last bytes of the line, as many as segN has
+		mutable SimpleArray<char> stream_tail;
+		mutable int stream_state{};
 	public:
-		CSimpleRegexp(const char* filter);
+		CSimpleRegexp(const char* filter, FilterSyntax syntax = FilterSyntax::Wildcard);
 		~CSimpleRegexp();
 		
 		// Flag that the correct wildcard is set
 		bool IsOk() const;
 		
-		// Sets a new wildcard
-		bool SetFilter(const char* filter);
+		// Sets a new wildcard or regular expression
+		bool SetFilter(const char* filter, FilterSyntax syntax = FilterSyntax::Wildcard);
 		
 		// Matches a string to a pattern
 		bool Match(const char* test)const;
+
+		// Matches a line which comes in pieces, the result is returned with the last piece
+		bool MatchPiece(const char* piece, size_t size, bool is_line_begin, bool is_line_end) const;
 	private:
 		// Collapsing consecutive asterisks
 		void Simplify(const char* filter);
-		void ResizeLookupBuffer(size_t new_lookup_size) const;
+		// Splitting the wildcard into segments
+		bool Split();
+		// Finds the leftmost occurrence of the segment in the text
+		const char* FindSegment(const char* text, size_t size, const Segment& segment) const;
+
+		void BeginLine() const;
+		void FeedLine(const char* piece, size_t size) const;
+		bool EndLine() const;
 	};
 }
 
@@ -0,0 +1,336 @@
+#include "TextFile.h"
+#include "Kernels.h"
+
+namespace log_test
+{
+    CTextFile::CTextFile(const char* file_name)
+    {
+        Open(file_name);
+    }
+
+    CTextFile::~CTextFile()
+    {
+        Reset();
+    }
+
+    const char* CTextFile::ReadLine()
+    {
+        if (Eof()) return {};
+        bool bad_alloc_flag = false;
+        current_line.Clear();
+        if (line_end)
+        {
+            line_offset = current_pos;
+            line_size = 0;
+        }
+        line_begin = line_end;
+        line_end = false;
+
+        while (IsOpen())
+        {
+            // The last line of a file that is still being written may have no line break
+            if (Eof())
+            {
+                line_end = true;
+                if (!current_line.PushBack(0))
+                {
+                    bad_alloc_flag = true;
+                    break;
+                }
+                return current_line.Data();
+            }
+            if (!current_chunk_size)
+            {
+                NextMapView();
+                if (!IsOpen()) break;
+            }
+
+            // The bytes up to \r or to the end of the MapView go to the line at once
+            const auto* cr = FindByte(pos_map_view, current_chunk_size, '\r');
+            DWORD run_size = cr ? static_cast<DWORD>(cr - pos_map_view) : current_chunk_size;
+            const size_t room = max_line_size - current_line.Size();
+            const bool is_full = run_size > room;
+            if (is_full)
+            {
+                run_size = static_cast<DWORD>(room);
+            }
+            if (!current_line.Append(pos_map_view, run_size))
+            {
+                bad_alloc_flag = true;
+                break;
+            }
+            pos_map_view += run_size;
+            current_chunk_size -= run_size;
+            current_pos += run_size;
+            line_size += run_size;
+            if (is_full)
+            {
+                // The line goes on in the next piece
+                line_end = Eof();
+                if (!current_line.PushBack(0))
+                {
+                    bad_alloc_flag = true;
+                    break;
+                }
+                return current_line.Data();
+            }
+            if (!cr) continue;
+
+            ReadByte();
+            if (Eof() || (ReadByte() == '\n'))
+            {
+                line_end = true;
+                if (!current_line.PushBack(0))
+                {
+                    bad_alloc_flag = true;
+                    break;
+                }
+                return current_line.Data();
+            }
+            break;
+        }
+
+        print_last_error(bad_alloc_flag ? "Bad alloc" : "Bad file");
+        Fail();
+        return {};
+    }
+
+    bool CTextFile::IsLineBegin() const
+    {
+        return line_begin;
+    }
+
+    bool CTextFile::IsLineEnd() const
+    {
+        return line_end;
+    }
+
+    unsigned long long CTextFile::LineOffset() const
+    {
+        return line_offset;
+    }
+
+    unsigned long long CTextFile::LineSize() const
+    {
+        return line_size;
+    }
+
+    void CTextFile::SetMaxLineSize(size_t size)
+    {
+        max_line_size = size ? size : 1;
+    }
+
+    size_t CTextFile::MaxLineSize() const
+    {
+        return max_line_size;
+    }
+
+    size_t CTextFile::ReadAt(unsigned long long read_offset, char* buf, size_t size) const
+    {
+        size_t copied{};
+        // ReadAt may run in another thread, so it does not depend on the state of reading line by line
+        while (copied < size && read_offset < file_size && hMapFile)
+        {
+            const auto view_offset = read_offset & ~static_cast<unsigned long long>(chunk_size - 1);
+            // The reads at nearby offsets go to the same MapView
+            if (!read_view || read_view_offset != view_offset)
+            {
+                UnMapReadView();
+                read_view_offset = view_offset;
+                read_view_size = static_cast<DWORD>(min(static_cast<unsigned long long>(chunk_size), file_size - view_offset));
+                const auto high = static_cast<DWORD>((view_offset >> 32) & offset_mask);
+                const auto low = static_cast<DWORD>(view_offset & offset_mask);
+                read_view = static_cast<const char*>(MapViewOfFile(hMapFile, FILE_MAP_READ, high, low, read_view_size));
+                if (!read_view)
+                {
+                    print_last_error("MapViewOfFile");
+                    break;
+                }
+            }
+            const auto view_pos = static_cast<size_t>(read_offset - view_offset);
+            const size_t part = min(size - copied, read_view_size - view_pos);
+            CopyMemory(buf + copied, read_view + view_pos, part);
+            copied += part;
+            read_offset += part;
+        }
+        return copied;
+    }
+
+    bool CTextFile::Eof() const
+    {
+        return current_pos >= file_size;
+    }
+
+    bool CTextFile::IsOpen() const
+    {
+        return is_open;
+    }
+
+    void CTextFile::Open(const char* file_name)
+    {
+        Reset();
+
+        hFile = CreateFileA(
+            file_name,
+            GENERIC_READ,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            0,
+            OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL,
+            0);
+
+        if (hFile == INVALID_HANDLE_VALUE)
+        {
+            print_last_error("CreateFileA");
+            return;
+        }
+
+        LARGE_INTEGER filesize{};
+
+        if (!GetFileSizeEx(hFile, &filesize))
+        {
+            print_last_error("GetFileSizeEx");
+            Reset();
+            return;
+        }
+
+        file_size = static_cast<unsigned long long>(filesize.QuadPart);
+
+        hMapFile = CreateFileMapping(hFile, nullptr, PAGE_READONLY, filesize.HighPart, filesize.LowPart, nullptr);
+        if (!hMapFile)
+        {
+            print_last_error("CreateFileMapping");
+            Reset();
+            return;
+        }
+        is_open = true;
+        NextMapView();
+    }
+
+    void CTextFile::Rewind()
+    {
+        if (!IsOpen()) return;
+        current_pos = 0;
+        offset = 0;
+        line_begin = line_end = true;
+        NextMapView();
+    }
+
+    void CTextFile::Seek(unsigned long long pos)
+    {
+        if (!IsOpen()) return;
+        line_begin = line_end = true;
+        if (pos >= file_size)
+        {
+            UnMapView();
+            current_chunk_size = 0;
+            current_pos = offset = file_size;
+            return;
+        }
+        // The MapView starts at a multiple of the granularity
+        offset = pos & ~static_cast<unsigned long long>(chunk_size - 1);
+        current_pos = offset;
+        NextMapView();
+        if (!IsOpen()) return;
+        const auto skip = static_cast<DWORD>(pos - current_pos);
+        pos_map_view += skip;
+        current_chunk_size -= skip;
+        current_pos = pos;
+    }
+
+    unsigned long long CTextFile::Tell() const
+    {
+        return current_pos;
+    }
+
+    unsigned long long CTextFile::Size() const
+    {
+        return file_size;
+    }
+
+    bool CTextFile::SizeChanged() const
+    {
+        LARGE_INTEGER filesize{};
+        if (hFile == INVALID_HANDLE_VALUE || !GetFileSizeEx(hFile, &filesize)) return true;
+        return static_cast<unsigned long long>(filesize.QuadPart) != file_size;
+    }
+
+    void CTextFile::Reset()
+    {
+        is_open = false;
+        file_size = 0;
+        current_pos = 0;
+        offset = 0;
+        current_chunk_size = 0;
+        line_offset = 0;
+        line_size = 0;
+        line_begin = line_end = true;
+        UnMapView();
+        UnMapReadView();
+        if (hMapFile)
+        {
+            CloseHandle(hMapFile);
+            hMapFile = NULL;
+        }
+
+        if (hFile != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(hFile);
+            hFile = INVALID_HANDLE_VALUE;
+        }
+    }
+
+    char CTextFile::ReadByte()
+    {
+        if (!current_chunk_size)
+        {
+            NextMapView();
+            if (!IsOpen()) return 0;
+        }
+        --current_chunk_size;
+        ++current_pos;
+        return *pos_map_view++;
+    }
+
+    void CTextFile::NextMapView()
+    {
+        UnMapView();
+        const auto high = static_cast<DWORD>((offset >> 32) & offset_mask);
+        const auto low = static_cast<DWORD>(offset & offset_mask);
+        current_chunk_size = (offset + chunk_size) > file_size ? static_cast<int>(file_size - offset) : chunk_size;
+        offset += current_chunk_size;
+        map_view = pos_map_view = static_cast<char*>(MapViewOfFile(hMapFile, FILE_MAP_READ, high, low, current_chunk_size));
+        if (!map_view)
+        {
+            print_last_error("MapViewOfFile");
+            Fail();
+        }
+    }
+
+    void CTextFile::Fail()
+    {
+        is_open = false;
+        current_pos = offset = file_size;
+        current_chunk_size = 0;
+        line_begin = line_end = true;
+        UnMapView();
+    }
+
+    void CTextFile::UnMapView()
+    {
+        if (map_view)
+        {
+            UnmapViewOfFile(map_view);
+            map_view = {};
+        }
+    }
+
+    void CTextFile::UnMapReadView() const
+    {
+        if (read_view)
+        {
+            UnmapViewOfFile(read_view);
+            read_view = {};
+        }
+    }
+}
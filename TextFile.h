@@ -0,0 +1,120 @@
+#pragma once
+#include <windows.h>
+#include "Utilities.h"
+
+namespace log_test
+{
+    /*********************************************************************************************
+    /*
+    /* Reading a text file line by line through a sequence of MapViews of chunk_size bytes
+    /*
+    /*********************************************************************************************/
+    class CTextFile final
+    {
+        static constexpr unsigned long long offset_mask = 0xFFFFFFFFul;
+        static constexpr size_t default_max_line_size = 0x100000;
+    public:
+
+        CTextFile() = default;
+        CTextFile(const char* file_name);
+        ~CTextFile();
+
+        // Read the characters and put to buffer the strings up to \\r\\n,
+        // a line longer than the max line size is returned in pieces of that size
+        const char* ReadLine();
+
+        // The last piece read is the beginning of its line
+        bool IsLineBegin() const;
+
+        // The last piece read is the end of its line
+        bool IsLineEnd() const;
+
+        // The sequence number of the first byte of the line of the last piece
+        unsigned long long LineOffset() const;
+
+        // Size of the line of the last piece up to the end of the piece, the whole line once it is complete
+        unsigned long long LineSize() const;
+
+        // Longer lines are returned in pieces, so the line buffer never grows beyond this size
+        void SetMaxLineSize(size_t size);
+
+        size_t MaxLineSize() const;
+
+        // Copies the bytes at the offset through its own MapView, reading line by line is not affected
+        // and may go on in another thread, returns the number of bytes copied.
+        // The file stays mapped for ReadAt after reading a line fails, until Reset
+        size_t ReadAt(unsigned long long read_offset, char* buf, size_t size) const;
+
+        bool Eof() const;
+
+        bool IsOpen() const;
+
+        // Open the file and create a memory mapped object
+        void Open(const char* file_name);
+
+        // Start reading again from the beginning of the file
+        void Rewind();
+
+        // Start reading from the byte with the sequence number pos, which is taken as the beginning of a line
+        void Seek(unsigned long long pos);
+
+        // The sequence number of the first byte of the next line
+        unsigned long long Tell() const;
+
+        unsigned long long Size() const;
+
+        // The file on disk no longer has the size it had when it was mapped
+        bool SizeChanged() const;
+
+        // release all resources
+        void Reset();
+
+    private:
+        // Reads the next byte from the MapView, if the MapView is over, shifts further by chunk_size
+        char ReadByte();
+
+        // Shifts further by chunk_size
+        void NextMapView();
+
+        // Stops reading line by line after an error, the file mapping is released by Reset
+        void Fail();
+
+        void UnMapView();
+
+        void UnMapReadView() const;
+
+    private:
+
+        // Set chunk size of the MapView according to granularity
+        const DWORD chunk_size = []
+        {
+            SYSTEM_INFO sysinfo = { 0 };
+            ::GetSystemInfo(&sysinfo);
+            return sysinfo.dwAllocationGranularity;
+        }();
+
+        // Size of the current chunk , for the last it may be less than chunk_size
+        DWORD  current_chunk_size{};
+        HANDLE hFile = INVALID_HANDLE_VALUE;
+        HANDLE hMapFile{};
+        unsigned long long file_size{};
+        // the sequence number of the current byte in the file
+        unsigned long long current_pos{};
+        // Pointer to the beginning of mapped memory
+        const char* map_view{};
+        const char* pos_map_view{};
+        unsigned long long offset{};
+        bool is_open{};
+        // The MapView of ReadAt
+        mutable const char* read_view{};
+        mutable unsigned long long read_view_offset{};
+        mutable DWORD read_view_size{};
+        // Current line buffer
+        SimpleString current_line;
+        size_t max_line_size = default_max_line_size;
+        unsigned long long line_offset{};
+        unsigned long long line_size{};
+        bool line_begin = true;
+        bool line_end = true;
+    };
+}
@@ -72,6 +72,22 @@ namespace log_test
         return true;
     }
 
+    bool SimpleString::Append(const char* src, size_t src_size)
+    {
+        if (size + src_size > alloc_size)
+        {
+            size_t new_alloc_size = alloc_size ? alloc_size : default_buffer_size;
+            while (new_alloc_size < size + src_size)
+                new_alloc_size *= 2;
+            ReallocBuffer(new_alloc_size);
+            if (!m_data)
+                return false;
+        }
+        CopyMemory(m_data + size, src, src_size);
+        size += src_size;
+        return true;
+    }
+
     const char* SimpleString::Data() const
     {
         return m_data;
@@ -83,6 +99,13 @@ namespace log_test
             ZeroMemory(m_data, alloc_size);
         size = 0;
     }
+
+    void SimpleString::Clear()
+    {
+        if (m_data)
+            m_data[0] = 0;
+        size = 0;
+    }
    
     void SimpleString::Set(const char* src, size_t new_size)
     {
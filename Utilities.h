@@ -1,7 +1,15 @@
 #pragma once
+#include <windows.h>
 
 namespace log_test
 {
+    // Syntax of a filter: * and ? wildcards matched against the whole line or a regular expression searched in the line
+    enum class FilterSyntax
+    {
+        Wildcard,
+        Regexp
+    };
+
     // Prints an error message and GetLastError code
     void print_last_error(const char* message);
 
@@ -20,10 +28,13 @@ namespace log_test
         SimpleString& operator=(const char*);
         ~SimpleString();
         bool PushBack(char ch);
+        bool Append(const char* src, size_t src_size);
         size_t Size() const;
         bool IsEmpty() const;
         const char* Data() const;
         void Reset();
+        // Empties the string, unlike Reset leaves the rest of the buffer as it is
+        void Clear();
         void Invalidate();
     private:
         void Set(const char* src, size_t size);
@@ -33,4 +44,105 @@ namespace log_test
         char* m_data{};
         static constexpr size_t default_buffer_size = 256;
     };
+
+    /*********************************************************************************************
+    /*
+    /* The same for an array of trivially copyable elements, new elements are zeroed
+    /*
+    /*********************************************************************************************/
+    template<typename T>
+    class SimpleArray final
+    {
+    public:
+        SimpleArray() = default;
+        SimpleArray(const SimpleArray&) = delete;
+        SimpleArray& operator=(const SimpleArray&) = delete;
+
+        ~SimpleArray()
+        {
+            Invalidate();
+        }
+
+        bool PushBack(const T& value)
+        {
+            if (size == alloc_size && !Reserve(alloc_size ? 2 * alloc_size : default_array_size))
+                return false;
+            m_data[size++] = value;
+            return true;
+        }
+
+        bool Resize(size_t new_size)
+        {
+            if (new_size > alloc_size && !Reserve(new_size))
+                return false;
+            if (new_size > size)
+                ZeroMemory(m_data + size, (new_size - size) * sizeof(T));
+            size = new_size;
+            return true;
+        }
+
+        size_t Size() const
+        {
+            return size;
+        }
+
+        bool IsEmpty() const
+        {
+            return !size;
+        }
+
+        T* Data()
+        {
+            return m_data;
+        }
+
+        const T* Data() const
+        {
+            return m_data;
+        }
+
+        T& operator[](size_t index)
+        {
+            return m_data[index];
+        }
+
+        const T& operator[](size_t index) const
+        {
+            return m_data[index];
+        }
+
+        void Reset()
+        {
+            size = 0;
+        }
+
+        void Invalidate()
+        {
+            if (m_data)
+                HeapFree(GetProcessHeap(), 0, m_data);
+            m_data = {};
+            size = 0;
+            alloc_size = 0;
+        }
+
+    private:
+        bool Reserve(size_t new_alloc_size)
+        {
+            auto* new_data = static_cast<T*>(
+                !m_data
+                ? HeapAlloc(GetProcessHeap(), 0, new_alloc_size * sizeof(T))
+                : HeapReAlloc(GetProcessHeap(), 0, m_data, new_alloc_size * sizeof(T))
+                );
+            if (!new_data)
+                return false;
+            m_data = new_data;
+            alloc_size = new_alloc_size;
+            return true;
+        }
+
+        size_t alloc_size{};
+        size_t size{};
+        T* m_data{};
+        static constexpr size_t default_array_size = 16;
+    };
 }
\ No newline at end of file
@@ -1,10 +1,137 @@
-#include "LogReader.h"
+#include "Kernels.h"
+#include "LogServer.h"
 
 #include <shellapi.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace
+{
+    log_test::CLogServer* running_server{};
+    const log_test::CLogReader* running_reader{};
+
+    BOOL WINAPI StopServer(DWORD)
+    {
+        running_server->Stop();
+        return TRUE;
+    }
+
+    void PrintLine(const char* buf, size_t)
+    {
+        printf("%s\n", buf);
+    }
+
+    // Prints a line longer than the max line size part by part
+    void PrintLongLine(unsigned long long offset, unsigned long long size)
+    {
+        static constexpr size_t buffer_size = 0x10000;
+        static char buf[buffer_size];
+        while (size)
+        {
+            const auto part = running_reader->ReadAt(offset, buf, static_cast<size_t>(min(static_cast<unsigned long long>(buffer_size), size)));
+            if (!part) break;
+            fwrite(buf, 1, part, stdout);
+            offset += part;
+            size -= part;
+        }
+        printf("\n");
+    }
+
+    // When the kernel variant is forced with LOGREADER_ISA, tells on stderr which one runs
+    void ReportIsa()
+    {
+        static constexpr DWORD name_size = 64;
+        char name[name_size] = {};
+        const DWORD size = GetEnvironmentVariableA("LOGREADER_ISA", name, name_size);
+        if (!size) return;
+
+        const char* selected = log_test::IsaName(log_test::SelectedIsa());
+        if (size >= name_size || _stricmp(name, selected))
+        {
+            fprintf(stderr, "LOGREADER_ISA=%s is unknown or not supported by the CPU\n", size < name_size ? name : "...");
+        }
+        fprintf(stderr, "kernels: %s\n", selected);
+    }
+
+    void PrintGap()
+    {
+        printf("--\n");
+    }
+
+    void PrintCount(const char* key, size_t, unsigned long long count)
+    {
+        printf("%10llu %s\n", count, key);
+    }
+}
 
 int main(int argc, char* argv[])
 {
+    // Options go before the other parameters
+    // -E : the filter is a regular expression
+    // -L <bytes> : lines longer than that are matched piece by piece
+    // -A <lines>, -B <lines>, -C <lines> : print the lines after, before or around each matched line
+    ReportIsa();
+    auto syntax = log_test::FilterSyntax::Wildcard;
+    size_t max_line_size{};
+    size_t context_before{};
+    size_t context_after{};
+    for (; argc > 1 && argv[1][0] == '-' && argv[1][1] != '-'; --argc, ++argv)
+    {
+        if (!strcmp(argv[1], "-E"))
+        {
+            syntax = log_test::FilterSyntax::Regexp;
+            continue;
+        }
+        if (!strcmp(argv[1], "-L") && argc > 2)
+        {
+            max_line_size = static_cast<size_t>(strtoull(argv[2], nullptr, 10));
+            --argc;
+            ++argv;
+            continue;
+        }
+        if ((!strcmp(argv[1], "-A") || !strcmp(argv[1], "-B") || !strcmp(argv[1], "-C")) && argc > 2)
+        {
+            const auto lines = static_cast<size_t>(strtoull(argv[2], nullptr, 10));
+            if (argv[1][1] != 'A') context_before = lines;
+            if (argv[1][1] != 'B') context_after = lines;
+            --argc;
+            ++argv;
+            continue;
+        }
+        printf("unknown option %s\n", argv[1]);
+        return -1;
+    }
+
+    // LogReader --daemon <socket> : serve queries until Ctrl+C
+    if (argc == 3 && !strcmp(argv[1], "--daemon"))
+    {
+        log_test::CLogServer server;
+        running_server = &server;
+        if (max_line_size) server.SetMaxLineSize(max_line_size);
+        SetConsoleCtrlHandler(StopServer, TRUE);
+        return server.Run(argv[2]) ? 0 : -1;
+    }
+
+    // LogReader [options] --query <socket> <file> <filter> : the test client of the daemon
+    if (argc == 5 && !strcmp(argv[1], "--query"))
+    {
+        return log_test::QueryServer(argv[2], argv[3], argv[4], syntax, PrintLine) ? 0 : -1;
+    }
+
+    // LogReader [options] --count-by <prefix size> <file> <filter> : the matched lines by their first bytes, e.g. a timestamp
+    // LogReader [options] --top <count> <file> <filter> : the most frequent templates of the matched lines
+    if (argc == 5 && (!strcmp(argv[1], "--count-by") || !strcmp(argv[1], "--top")))
+    {
+        const auto size = static_cast<size_t>(strtoull(argv[2], nullptr, 10));
+        log_test::CLogReader reader;
+        if (max_line_size) reader.SetMaxLineSize(max_line_size);
+        if (!reader.SetFilter(argv[4], syntax)) return -1;
+        if (!reader.Open(argv[3])) return -1;
+        const bool result = !strcmp(argv[1], "--top") ? reader.TopTemplates(size, PrintCount) : reader.CountByPrefix(size, PrintCount);
+        return result ? 0 : -1;
+    }
+
     if (argc < 3)
     {
         printf("there should be 2 parameters\n");
@@ -12,7 +139,10 @@ int main(int argc, char* argv[])
     }
 
     log_test::CLogReader reader;
-    if (!reader.SetFilter(argv[2])) return -1;
+    running_reader = &reader;
+    if (max_line_size) reader.SetMaxLineSize(max_line_size);
+    reader.SetContext(context_before, context_after, PrintGap);
+    if (!reader.SetFilter(argv[2], syntax)) return -1;
     if (!reader.Open(argv[1])) return -1;
 
 #if 0
@@ -26,13 +156,13 @@ int main(int argc, char* argv[])
     reader.Enumerate([](const char* buf, size_t)
         {
             printf("%s\n", buf);
-        }
+        }, PrintLongLine
     );
 #else  
     reader.AsyncEnumerate([](const char* buf, size_t)
         {
             printf("%s\n", buf);
-        }
+        }, PrintLongLine
     );
 #endif
     return 0;